@@ -1,4 +1,4 @@
-QT       += core gui opengl
+QT       += core gui opengl concurrent
 
 greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
 
@@ -11,11 +11,58 @@ CONFIG += c++11
 SOURCES += \
         main.cpp \
         window.cpp \
-    glwidget.cpp
+    glwidget.cpp \
+    renderer.cpp \
+    renderqueue.cpp \
+    benchmark.cpp \
+    bvh.cpp \
+    entitystore.cpp \
+    framecapture.cpp \
+    geometryarena.cpp \
+    glstatecache.cpp \
+    inputlog.cpp \
+    meshgenerator.cpp \
+    meshloader.cpp \
+    meshcache.cpp \
+    meshoptimizer.cpp \
+    programcache.cpp \
+    renderthread.cpp \
+    renderwindow.cpp \
+    scenedriver.cpp \
+    simulationclock.cpp \
+    streamring.cpp \
+    texturecache.cpp \
+    texturestreamer.cpp \
+    transformkernel.cpp \
+    vertexformat.cpp
 
 HEADERS += \
         window.h \
-    glwidget.h
+    glwidget.h \
+    renderer.h \
+    renderqueue.h \
+    benchmark.h \
+    bvh.h \
+    entitystore.h \
+    framecapture.h \
+    geometryarena.h \
+    glstatecache.h \
+    inputlog.h \
+    meshgenerator.h \
+    meshloader.h \
+    meshcache.h \
+    meshoptimizer.h \
+    programcache.h \
+    renderthread.h \
+    renderwindow.h \
+    scenedriver.h \
+    simulationclock.h \
+    spscqueue.h \
+    streamring.h \
+    texturecache.h \
+    texturestreamer.h \
+    transformkernel.h \
+    vertexformat.h
 
 qnx: target.path = /tmp/$${TARGET}/bin
 else: unix:!android: target.path = /opt/$${TARGET}/bin
@@ -0,0 +1,432 @@
+#include "benchmark.h"
+#include "framecapture.h"
+#include "renderer.h"
+#include "meshloader.h"
+#include "transformkernel.h"
+
+#include <QCommandLineParser>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QOffscreenSurface>
+#include <QOpenGLContext>
+#include <QOpenGLFramebufferObject>
+#include <QOpenGLFunctions>
+#include <QRandomGenerator>
+#include <QtMath>
+#include <algorithm>
+#include <cstdio>
+#include <cstring>
+
+struct BenchmarkOptions
+{
+    int frames;
+    int warmup;
+    QSize size;
+    bool instanced;
+    bool occlusion;
+    int objects;
+    int triangleBudget;
+    bool transforms;
+    QString capture; // directory, empty - no capture
+    FrameCapture::Format captureFormat;
+    QString output;
+    QStringList meshes; // "kind=path"
+};
+
+static bool parseOptions(const QStringList &arguments, BenchmarkOptions &options)
+{
+    QCommandLineParser parser;
+    parser.setApplicationDescription("Headless rendering benchmark");
+    parser.addHelpOption();
+    QCommandLineOption benchmarkOption("benchmark", "Run the headless benchmark instead of the UI.");
+    QCommandLineOption framesOption("frames", "Number of measured frames.", "count", "500");
+    QCommandLineOption warmupOption("warmup", "Frames rendered before measuring.", "count", "30");
+    QCommandLineOption sizeOption("size", "Framebuffer size.", "WxH", "1280x720");
+    QCommandLineOption instancedOption("instanced", "Use the instanced rendering path.");
+    QCommandLineOption occlusionOption("occlusion", "Skip objects hidden behind others with occlusion queries.");
+    QCommandLineOption objectsOption("objects", "Extra objects scattered behind the scene.", "count", "0");
+    QCommandLineOption budgetOption("triangle-budget", "Triangles per frame before objects switch to coarser levels of detail.", "count", "1000000");
+    QCommandLineOption transformsOption("transforms", "Only time model matrix building on the CPU, no rendering.");
+    QCommandLineOption captureOption("capture", "Also save every measured frame to a directory.", "directory");
+    QCommandLineOption captureFormatOption("capture-format", "Captured frame format: png or raw.", "format", "png");
+    QCommandLineOption outputOption("output", "JSON report file, stdout if omitted.", "file");
+    QCommandLineOption meshOption("mesh", "Replace a mesh type with an OBJ or glTF file.", "kind=file");
+    parser.addOptions({ benchmarkOption, framesOption, warmupOption, sizeOption, instancedOption, occlusionOption, objectsOption, budgetOption, transformsOption, captureOption, captureFormatOption, outputOption, meshOption });
+    parser.process(arguments);
+
+    bool framesOk, warmupOk, objectsOk, budgetOk, widthOk = false, heightOk = false;
+    options.frames = parser.value(framesOption).toInt(&framesOk);
+    options.warmup = parser.value(warmupOption).toInt(&warmupOk);
+    QStringList size = parser.value(sizeOption).split('x');
+    if (size.size() == 2)
+        options.size = QSize(size[0].toInt(&widthOk), size[1].toInt(&heightOk));
+    options.instanced = parser.isSet(instancedOption);
+    options.occlusion = parser.isSet(occlusionOption);
+    options.objects = parser.value(objectsOption).toInt(&objectsOk);
+    options.triangleBudget = parser.value(budgetOption).toInt(&budgetOk);
+    options.transforms = parser.isSet(transformsOption);
+    options.capture = parser.value(captureOption);
+    options.output = parser.value(outputOption);
+    options.meshes = parser.values(meshOption);
+
+    if (!framesOk || options.frames <= 0 || !warmupOk || options.warmup < 0) {
+        qCritical("Benchmark: --frames must be positive and --warmup non-negative");
+        return false;
+    }
+    if (!objectsOk || options.objects < 0) {
+        qCritical("Benchmark: --objects must be non-negative");
+        return false;
+    }
+    if (!budgetOk || options.triangleBudget < 0) {
+        qCritical("Benchmark: --triangle-budget must be non-negative");
+        return false;
+    }
+    if (!FrameCapture::formatFromName(parser.value(captureFormatOption), options.captureFormat)) {
+        qCritical("Benchmark: --capture-format must be png or raw");
+        return false;
+    }
+    if (!widthOk || !heightOk || options.size.isEmpty()) {
+        qCritical("Benchmark: --size must look like 1280x720");
+        return false;
+    }
+    return true;
+}
+
+// Fixed camera path: slow strafe and dolly in front of the scene, objects turn one degree per frame
+static FrameState cameraPath(int frame)
+{
+    const float t = frame / 60.0f;
+    FrameState state;
+    state.cameraPos = QVector3D(1.5f * qSin(t), qSin(0.5f * t), 3.0f + 2.0f * qCos(0.25f * t));
+    state.cameraFront = QVector3D(0.0f, 0.0f, -1.0f);
+    state.cameraUp = QVector3D(0.0f, 1.0f, 0.0f);
+    state.xRot = state.yRot = state.zRot = (frame * 16) % (360 * 16);
+    return state;
+}
+
+// Nearest-rank percentile of an ascending sorted sample
+static double percentile(const QVector<double> &sorted, double p)
+{
+    int rank = qCeil(p / 100.0 * sorted.size());
+    return sorted[qBound(0, rank - 1, sorted.size() - 1)];
+}
+
+static QJsonObject frameTimeStats(QVector<double> times)
+{
+    std::sort(times.begin(), times.end());
+    double sum = 0.0;
+    for (double time : times)
+        sum += time;
+
+    QJsonObject stats;
+    stats["mean"] = sum / times.size();
+    stats["p50"] = percentile(times, 50.0);
+    stats["p95"] = percentile(times, 95.0);
+    stats["p99"] = percentile(times, 99.0);
+    stats["max"] = times.last();
+    return stats;
+}
+
+static int writeReport(const QJsonObject &report, const QString &output)
+{
+    QByteArray json = QJsonDocument(report).toJson();
+    if (output.isEmpty()) {
+        fwrite(json.constData(), 1, json.size(), stdout);
+        return 0;
+    }
+    QFile file(output);
+    if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate) || file.write(json) != json.size()) {
+        qCritical("Benchmark: can't write %s", qPrintable(output));
+        return 1;
+    }
+    return 0;
+}
+
+// Model matrix of one object the way Renderer built it before the batch kernel
+static QMatrix4x4 qtModelMatrix(const QVector3D &position, const QQuaternion &rotation, const QVector3D &scale,
+                                const FrameState &state)
+{
+    QMatrix4x4 model;
+    model.translate(position);
+    model.rotate(rotation);
+    model.scale(scale);
+    model.rotate(180.0f - (state.xRot / 16.0f), 1.0f, 0.0f, 0.0f);
+    model.rotate(state.yRot / 16.0f, 0.0f, 1.0f, 0.0f);
+    model.rotate(state.zRot / 16.0f, 0.0f, 0.0f, 1.0f);
+    return model;
+}
+
+// CPU only: the per-object QMatrix4x4 path against the scalar and the SIMD kernel, one
+// "frame" of --objects matrices per iteration along the same rotation path as the scene
+static int runTransformBenchmark(const BenchmarkOptions &options)
+{
+    const int count = options.objects > 0 ? options.objects : 100000;
+    QRandomGenerator random(1);
+    QVector<QVector3D> positions(count);
+    QVector<QQuaternion> rotations(count);
+    QVector<QVector3D> scales(count);
+    QVector<int> objectSlots(count);
+    for (int i = 0; i < count; i++) {
+        positions[i] = QVector3D(float(random.bounded(40.0) - 20.0), float(random.bounded(20.0) - 10.0),
+                                 float(-random.bounded(60.0)));
+        QVector3D axis(float(random.bounded(2.0) - 1.0), float(random.bounded(2.0) - 1.0), 1.0f);
+        rotations[i] = QQuaternion::fromAxisAndAngle(axis.normalized(), float(random.bounded(360.0)));
+        scales[i] = QVector3D(1.0f, 1.0f, 1.0f) * float(0.5 + random.bounded(1.5));
+        objectSlots[i] = i;
+    }
+
+    QVector<GLfloat> reference(count * 16);
+    QVector<GLfloat> scalar(count * 16);
+    QVector<GLfloat> kernel(count * 16);
+    QVector<double> qtTimes, scalarTimes, kernelTimes;
+    QElapsedTimer timer;
+    for (int frame = -options.warmup; frame < options.frames; frame++) {
+        const FrameState state = cameraPath(frame);
+
+        timer.start();
+        for (int i = 0; i < count; i++) {
+            QMatrix4x4 model = qtModelMatrix(positions[i], rotations[i], scales[i], state);
+            memcpy(reference.data() + 16 * i, model.constData(), 16 * sizeof(GLfloat));
+        }
+        const double qtMs = timer.nsecsElapsed() / 1.0e6;
+
+        timer.start();
+        composeModelMatricesScalar(Renderer::sharedRotation(state), positions.constData(), rotations.constData(),
+                                   scales.constData(), objectSlots.constData(), count, scalar.data());
+        const double scalarMs = timer.nsecsElapsed() / 1.0e6;
+
+        timer.start();
+        composeModelMatrices(Renderer::sharedRotation(state), positions.constData(), rotations.constData(),
+                             scales.constData(), objectSlots.constData(), count, kernel.data());
+        const double kernelMs = timer.nsecsElapsed() / 1.0e6;
+
+        if (frame < 0)
+            continue;
+        qtTimes.append(qtMs);
+        scalarTimes.append(scalarMs);
+        kernelTimes.append(kernelMs);
+    }
+
+    // Both kernels must agree with QMatrix4x4 up to float rounding
+    double scalarError = 0.0, kernelError = 0.0;
+    for (int i = 0; i < reference.size(); i++) {
+        scalarError = qMax(scalarError, double(qAbs(scalar[i] - reference[i])));
+        kernelError = qMax(kernelError, double(qAbs(kernel[i] - reference[i])));
+    }
+
+    QJsonObject report;
+    report["objects"] = count;
+    report["frames"] = options.frames;
+    report["warmup"] = options.warmup;
+    report["kernel"] = QString(transformKernelName());
+    report["qmatrix4x4_ms"] = frameTimeStats(qtTimes);
+    report["scalar_ms"] = frameTimeStats(scalarTimes);
+    report["kernel_ms"] = frameTimeStats(kernelTimes);
+    report["scalar_max_error"] = scalarError;
+    report["kernel_max_error"] = kernelError;
+    return writeReport(report, options.output);
+}
+
+int runBenchmark(const QStringList &arguments)
+{
+    BenchmarkOptions options;
+    if (!parseOptions(arguments, options))
+        return 1;
+    if (options.transforms)
+        return runTransformBenchmark(options);
+
+    QSurfaceFormat format;
+    format.setVersion(3, 3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    format.setDepthBufferSize(24);
+
+    QOpenGLContext context;
+    context.setFormat(format);
+    if (!context.create()) {
+        qCritical("Benchmark: can't create an OpenGL 3.3 core context");
+        return 1;
+    }
+    QOffscreenSurface surface;
+    surface.setFormat(context.format());
+    surface.create();
+    if (!surface.isValid() || !context.makeCurrent(&surface)) {
+        qCritical("Benchmark: can't make the offscreen surface current");
+        return 1;
+    }
+
+    QOpenGLFunctions *f = context.functions();
+    QJsonObject report;
+    report["gl_vendor"] = QString::fromLatin1(reinterpret_cast<const char *>(f->glGetString(GL_VENDOR)));
+    report["gl_renderer"] = QString::fromLatin1(reinterpret_cast<const char *>(f->glGetString(GL_RENDERER)));
+    report["gl_version"] = QString::fromLatin1(reinterpret_cast<const char *>(f->glGetString(GL_VERSION)));
+    report["width"] = options.size.width();
+    report["height"] = options.size.height();
+    report["frames"] = options.frames;
+    report["warmup"] = options.warmup;
+    report["instanced"] = options.instanced;
+    report["occlusion"] = options.occlusion;
+    report["objects"] = options.objects;
+    report["triangle_budget"] = options.triangleBudget;
+    report["capture"] = !options.capture.isEmpty();
+
+    {
+        // GL objects must die while the context is still current
+        QOpenGLFramebufferObject fbo(options.size, QOpenGLFramebufferObject::Depth);
+        fbo.bind();
+        f->glViewport(0, 0, options.size.width(), options.size.height());
+
+        Renderer renderer;
+        renderer.initialize();
+        renderer.finishLoading();
+        renderer.setInstanced(options.instanced);
+        renderer.setOcclusionCulling(options.occlusion);
+        renderer.setTriangleBudget(options.triangleBudget);
+        FrameCapture capture;
+        capture.initialize();
+        // Same pseudo-random field on every run, so reports stay comparable
+        QRandomGenerator random(1);
+        for (int i = 0; i < options.objects; i++) {
+            QVector3D position(float(random.bounded(40.0) - 20.0),
+                               float(random.bounded(20.0) - 10.0),
+                               float(-5.0 - random.bounded(60.0)));
+            renderer.addObject(Renderer::MeshKind(i % Renderer::MeshKindCount), position);
+        }
+        for (const QString &spec : options.meshes) {
+            Renderer::MeshKind kind;
+            int separator = spec.indexOf('=');
+            if (separator < 0 || !Renderer::meshKindFromName(spec.left(separator), kind)) {
+                qCritical("Benchmark: bad --mesh value: %s", qPrintable(spec));
+                return 1;
+            }
+            MeshData mesh = MeshLoader::loadCached(spec.mid(separator + 1));
+            if (!mesh.isValid()) {
+                qCritical("Benchmark: %s", qPrintable(mesh.error));
+                return 1;
+            }
+            renderer.uploadMesh(kind, mesh);
+        }
+
+        QVector<double> frameTimes;
+        frameTimes.reserve(options.frames);
+        double gpuSum[Renderer::MeshKindCount] = {};
+        int gpuSamples[Renderer::MeshKindCount] = {};
+        double cpuSum[Renderer::MeshKindCount] = {};
+        double visibleSum = 0.0, occludedSum = 0.0, cullSum = 0.0, queueSum = 0.0;
+        double issuedSum = 0.0, skippedSum = 0.0;
+        double lodTrianglesSum = 0.0, lodBiasSum = 0.0;
+        double lodObjectsSum[Renderer::MaxLodLevels] = {};
+        int lodTrianglesMax = 0;
+        QElapsedTimer timer;
+        for (int frame = -options.warmup; frame < options.frames; frame++) {
+            FrameState state = cameraPath(frame);
+            if (frame == 0 && !options.capture.isEmpty() && !capture.start(options.capture, options.captureFormat))
+                return 1;
+            timer.start();
+            renderer.render(state, options.size.width(), options.size.height());
+            capture.capture(options.size.width(), options.size.height());
+            // Wait for the frame so the GPU (or software rasterizer) work is part of the measurement
+            f->glFinish();
+            if (frame < 0)
+                continue;
+            frameTimes.append(timer.nsecsElapsed() / 1.0e6);
+            visibleSum += renderer.cullStats().visible;
+            occludedSum += renderer.cullStats().occluded;
+            cullSum += renderer.cullStats().cpuMs;
+            queueSum += renderer.cullStats().queueMs;
+            issuedSum += renderer.stateCounters().issued;
+            skippedSum += renderer.stateCounters().skipped;
+            const Renderer::LodStats &lod = renderer.lodStats();
+            lodTrianglesSum += lod.triangles;
+            lodTrianglesMax = qMax(lodTrianglesMax, lod.triangles);
+            lodBiasSum += lod.bias;
+            for (int level = 0; level < Renderer::MaxLodLevels; level++)
+                lodObjectsSum[level] += lod.objects[level];
+            for (int kind = 0; kind < Renderer::MeshKindCount; kind++) {
+                const Renderer::GroupStats &stats = renderer.groupStats(Renderer::MeshKind(kind));
+                cpuSum[kind] += stats.cpuMs;
+                if (stats.gpuMs >= 0.0) {
+                    gpuSum[kind] += stats.gpuMs;
+                    gpuSamples[kind]++;
+                }
+            }
+        }
+        report["frame_time_ms"] = frameTimeStats(frameTimes);
+
+        QJsonObject groups;
+        for (int kind = 0; kind < Renderer::MeshKindCount; kind++) {
+            const Renderer::GroupStats &stats = renderer.groupStats(Renderer::MeshKind(kind));
+            QJsonObject group;
+            group["gpu_ms_mean"] = gpuSamples[kind] ? gpuSum[kind] / gpuSamples[kind] : -1.0;
+            group["cpu_ms_mean"] = cpuSum[kind] / options.frames;
+            group["draw_calls"] = stats.drawCalls;
+            group["triangles"] = stats.triangles;
+            const MeshOptimizeStats &optimized = renderer.meshOptimizeStats(Renderer::MeshKind(kind));
+            group["vertices_before_optimize"] = optimized.verticesBefore;
+            group["vertices_after_optimize"] = optimized.verticesAfter;
+            group["acmr_before_optimize"] = optimized.acmrBefore;
+            group["acmr_after_optimize"] = optimized.acmrAfter;
+            groups[Renderer::meshName(Renderer::MeshKind(kind))] = group;
+        }
+        report["groups"] = groups;
+
+        QJsonObject culling;
+        culling["objects"] = renderer.cullStats().objects;
+        culling["visible_mean"] = visibleSum / options.frames;
+        culling["occluded_mean"] = occludedSum / options.frames;
+        culling["cpu_ms_mean"] = cullSum / options.frames;
+        culling["queue_ms_mean"] = queueSum / options.frames;
+        report["culling"] = culling;
+
+        QJsonObject lod;
+        QJsonArray levels;
+        for (double objects : lodObjectsSum)
+            levels.append(objects / options.frames);
+        lod["triangles_mean"] = lodTrianglesSum / options.frames;
+        lod["triangles_max"] = lodTrianglesMax;
+        lod["bias_mean"] = lodBiasSum / options.frames;
+        lod["objects_per_level_mean"] = levels;
+        report["lod"] = lod;
+
+        QJsonObject binds;
+        binds["issued_mean"] = issuedSum / options.frames;
+        binds["skipped_mean"] = skippedSum / options.frames;
+        report["binds"] = binds;
+
+        const ProgramCache::Stats &programs = renderer.programCacheStats();
+        QJsonObject programCache;
+        programCache["hits"] = programs.hits;
+        programCache["misses"] = programs.misses;
+        programCache["load_ms"] = programs.loadMs;
+        programCache["compile_ms"] = programs.compileMs;
+        report["program_cache"] = programCache;
+
+        QJsonObject geometry;
+        geometry["bytes"] = double(renderer.geometryBytes());
+        geometry["bytes_saved"] = double(renderer.geometryBytesSaved());
+        report["geometry"] = geometry;
+
+        QJsonObject ring;
+        ring["region_bytes"] = double(renderer.instanceRingBytes());
+        ring["fence_waits"] = renderer.instanceRingWaits();
+        report["instance_ring"] = ring;
+
+        // Also waits for the writers, so written is final
+        capture.cleanup();
+        if (!options.capture.isEmpty()) {
+            const FrameCapture::Stats stats = capture.stats();
+            QJsonObject frames;
+            frames["frames"] = stats.frames;
+            frames["written"] = stats.written;
+            frames["dropped"] = stats.dropped;
+            frames["waits"] = stats.waits;
+            report["capture_stats"] = frames;
+        }
+        renderer.cleanup();
+        fbo.release();
+    }
+    context.doneCurrent();
+    return writeReport(report, options.output);
+}
@@ -0,0 +1,10 @@
+#ifndef BENCHMARK_H
+#define BENCHMARK_H
+
+#include <QStringList>
+
+// Headless benchmark: renders the scene into an FBO on a QOffscreenSurface along a fixed
+// camera path and writes frame-time statistics as JSON. Returns the process exit code.
+int runBenchmark(const QStringList &arguments);
+
+#endif // BENCHMARK_H
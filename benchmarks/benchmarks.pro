@@ -0,0 +1,53 @@
+QT       += core gui opengl concurrent testlib
+
+greaterThan(QT_MAJOR_VERSION, 4): QT += widgets
+
+TARGET = hotpaths
+TEMPLATE = app
+DEFINES += QT_DEPRECATED_WARNINGS
+
+CONFIG += c++11 console
+CONFIG -= app_bundle
+
+# The application sources minus the UI, so the benchmarks run the real code
+INCLUDEPATH += ..
+
+SOURCES += \
+    tst_hotpaths.cpp \
+    ../renderer.cpp \
+    ../renderqueue.cpp \
+    ../bvh.cpp \
+    ../entitystore.cpp \
+    ../geometryarena.cpp \
+    ../glstatecache.cpp \
+    ../meshgenerator.cpp \
+    ../meshloader.cpp \
+    ../meshcache.cpp \
+    ../meshoptimizer.cpp \
+    ../programcache.cpp \
+    ../streamring.cpp \
+    ../texturecache.cpp \
+    ../texturestreamer.cpp \
+    ../transformkernel.cpp \
+    ../vertexformat.cpp
+
+HEADERS += \
+    ../renderer.h \
+    ../renderqueue.h \
+    ../bvh.h \
+    ../entitystore.h \
+    ../geometryarena.h \
+    ../glstatecache.h \
+    ../meshgenerator.h \
+    ../meshloader.h \
+    ../meshcache.h \
+    ../meshoptimizer.h \
+    ../programcache.h \
+    ../streamring.h \
+    ../texturecache.h \
+    ../texturestreamer.h \
+    ../transformkernel.h \
+    ../vertexformat.h
+
+RESOURCES += \
+    ../resources.qrc
@@ -0,0 +1,259 @@
+#include "entitystore.h"
+#include "meshgenerator.h"
+#include "meshoptimizer.h"
+#include "renderer.h"
+#include "transformkernel.h"
+#include "vertexformat.h"
+
+#include <QDir>
+#include <QFile>
+#include <QImage>
+#include <QRandomGenerator>
+#include <QtTest>
+#include <cstring>
+
+// CPU stages of a frame and of asset loading, each on its own and without a GL context.
+// Scene sizes are rows of the _data() functions; run with e.g. "-o hotpaths.xml,xml" or
+// "-o hotpaths.csv,csv" for results a script can compare between releases.
+class HotPaths : public QObject
+{
+    Q_OBJECT
+
+private slots:
+    void modelMatricesQt_data() { sceneSizes(); }
+    void modelMatricesQt();
+    void modelMatricesScalar_data() { sceneSizes(); }
+    void modelMatricesScalar();
+    void modelMatrices_data() { sceneSizes(); }
+    void modelMatrices();
+    void normalizeAngle_data() { sceneSizes(); }
+    void normalizeAngle();
+
+    void decodeTexture_data() { textures(); }
+    void decodeTexture();
+    void convertTexture_data() { textures(); }
+    void convertTexture();
+    void mirrorTexture_data() { textures(); }
+    void mirrorTexture();
+
+    void chooseVertexFormat_data() { meshSizes(); }
+    void chooseVertexFormat();
+    void packVertices_data() { meshSizes(); }
+    void packVertices();
+    void packIndices_data() { meshSizes(); }
+    void packIndices();
+    void optimizeMesh_data() { meshSizes(); }
+    void optimizeMesh();
+
+private:
+    void sceneSizes();
+    void textures();
+    void meshSizes();
+    void fillScene(EntityStore &store, QVector<int> &objectSlots, int count);
+    void qtModelMatrices(const EntityStore &store, const FrameState &state, GLfloat *out);
+    void compareToQt(const EntityStore &store, const FrameState &state, const QVector<GLfloat> &out);
+};
+
+// Same pseudo-random field as the headless benchmark, so the numbers relate
+void HotPaths::fillScene(EntityStore &store, QVector<int> &objectSlots, int count)
+{
+    QRandomGenerator random(1);
+    objectSlots.resize(count);
+    for (int i = 0; i < count; i++) {
+        QVector3D position(float(random.bounded(40.0) - 20.0), float(random.bounded(20.0) - 10.0),
+                           float(-random.bounded(60.0)));
+        QVector3D axis(float(random.bounded(2.0) - 1.0), float(random.bounded(2.0) - 1.0), 1.0f);
+        QQuaternion rotation = QQuaternion::fromAxisAndAngle(axis.normalized(), float(random.bounded(360.0)));
+        store.add(i % Renderer::MeshKindCount, i % Renderer::MeshKindCount, position, rotation,
+                  QVector3D(1.0f, 1.0f, 1.0f) * float(0.5 + random.bounded(1.5)));
+        objectSlots[i] = i;
+    }
+}
+// Per object translate and three rotate calls, how the model matrices were built before
+// the batch kernel
+void HotPaths::qtModelMatrices(const EntityStore &store, const FrameState &state, GLfloat *out)
+{
+    for (int i = 0; i < store.size(); i++) {
+        QMatrix4x4 model;
+        model.translate(store.positions()[i]);
+        model.rotate(store.rotations()[i]);
+        model.scale(store.scales()[i]);
+        model.rotate(180.0f - (state.xRot / 16.0f), 1.0f, 0.0f, 0.0f);
+        model.rotate(state.yRot / 16.0f, 0.0f, 1.0f, 0.0f);
+        model.rotate(state.zRot / 16.0f, 0.0f, 0.0f, 1.0f);
+        memcpy(out + 16 * i, model.constData(), 16 * sizeof(GLfloat));
+    }
+}
+// The kernels must build the same matrices as the QMatrix4x4 path they replace
+void HotPaths::compareToQt(const EntityStore &store, const FrameState &state, const QVector<GLfloat> &out)
+{
+    QVector<GLfloat> expected(out.size());
+    qtModelMatrices(store, state, expected.data());
+    float error = 0.0f;
+    for (int i = 0; i < out.size(); i++)
+        error = qMax(error, qAbs(out[i] - expected[i]));
+    QVERIFY2(error < 1.0e-4f, qPrintable(QString("matrices differ by %1").arg(error)));
+}
+void HotPaths::sceneSizes()
+{
+    QTest::addColumn<int>("objects");
+    for (int objects = 10; objects <= 1000000; objects *= 10)
+        QTest::newRow(qPrintable(QString::number(objects))) << objects;
+}
+void HotPaths::textures()
+{
+    QTest::addColumn<QByteArray>("encoded");
+    const QStringList names = QDir(":/img").entryList(QStringList() << "*.jpg", QDir::Files, QDir::Name);
+    for (const QString &name : names) {
+        QFile file(":/img/" + name);
+        QVERIFY(file.open(QIODevice::ReadOnly));
+        QTest::newRow(qPrintable(name)) << file.readAll();
+    }
+}
+void HotPaths::meshSizes()
+{
+    // Sphere of the given segment count, from the coarsest level of detail to an imported model
+    QTest::addColumn<int>("segments");
+    for (int segments = 8; segments <= 512; segments *= 4)
+        QTest::newRow(qPrintable(QString("sphere%1").arg(segments))) << segments;
+}
+
+void HotPaths::modelMatricesQt()
+{
+    QFETCH(int, objects);
+    EntityStore store;
+    QVector<int> objectSlots;
+    fillScene(store, objectSlots, objects);
+    QVector<GLfloat> out(16 * objects);
+    FrameState state = {};
+    state.xRot = state.yRot = state.zRot = 40 * 16;
+    QBENCHMARK {
+        qtModelMatrices(store, state, out.data());
+    }
+}
+void HotPaths::modelMatricesScalar()
+{
+    QFETCH(int, objects);
+    EntityStore store;
+    QVector<int> objectSlots;
+    fillScene(store, objectSlots, objects);
+    QVector<GLfloat> out(16 * objects);
+    FrameState state = {};
+    state.xRot = state.yRot = state.zRot = 40 * 16;
+    QBENCHMARK {
+        composeModelMatricesScalar(Renderer::sharedRotation(state), store.positions(), store.rotations(),
+                                   store.scales(), objectSlots.constData(), objects, out.data());
+    }
+    compareToQt(store, state, out);
+}
+void HotPaths::modelMatrices()
+{
+    QFETCH(int, objects);
+    EntityStore store;
+    QVector<int> objectSlots;
+    fillScene(store, objectSlots, objects);
+    QVector<GLfloat> out(16 * objects);
+    FrameState state = {};
+    state.xRot = state.yRot = state.zRot = 40 * 16;
+    QBENCHMARK {
+        composeModelMatrices(Renderer::sharedRotation(state), store.positions(), store.rotations(),
+                             store.scales(), objectSlots.constData(), objects, out.data());
+    }
+    compareToQt(store, state, out);
+}
+void HotPaths::normalizeAngle()
+{
+    QFETCH(int, objects);
+    // Mouse drags move angles by up to a few turns either way
+    QRandomGenerator random(1);
+    QVector<int> angles(objects);
+    for (int &angle : angles)
+        angle = random.bounded(-4 * 360 * 16, 4 * 360 * 16);
+    QVector<int> normalized(objects);
+    QBENCHMARK {
+        for (int i = 0; i < objects; i++) {
+            int angle = angles[i];
+            qNormalizeAngle(angle);
+            normalized[i] = angle;
+        }
+    }
+    QVERIFY(normalized.first() >= 0 && normalized.first() <= 360 * 16);
+}
+
+// The steps TextureCache takes on a miss before building mip levels
+void HotPaths::decodeTexture()
+{
+    QFETCH(QByteArray, encoded);
+    QImage image;
+    QBENCHMARK {
+        image = QImage::fromData(encoded);
+    }
+    QVERIFY(!image.isNull());
+}
+void HotPaths::convertTexture()
+{
+    QFETCH(QByteArray, encoded);
+    const QImage decoded = QImage::fromData(encoded);
+    QVERIFY(!decoded.isNull());
+    QImage image;
+    QBENCHMARK {
+        image = decoded.convertToFormat(QImage::Format_RGB888);
+    }
+}
+void HotPaths::mirrorTexture()
+{
+    QFETCH(QByteArray, encoded);
+    const QImage converted = QImage::fromData(encoded).convertToFormat(QImage::Format_RGB888);
+    QVERIFY(!converted.isNull());
+    QImage image;
+    QBENCHMARK {
+        image = converted.mirrored(false, true);
+    }
+}
+
+// What GeometryArena does to a mesh before its one glBufferSubData
+void HotPaths::chooseVertexFormat()
+{
+    QFETCH(int, segments);
+    const MeshData mesh = MeshGenerator::sphere(segments);
+    VertexFormat format;
+    QBENCHMARK {
+        format = VertexFormat::choose(mesh.vertices);
+    }
+}
+void HotPaths::packVertices()
+{
+    QFETCH(int, segments);
+    const MeshData mesh = MeshGenerator::sphere(segments);
+    const VertexFormat format = VertexFormat::choose(mesh.vertices);
+    QByteArray packed;
+    QBENCHMARK {
+        packed = format.pack(mesh.vertices);
+    }
+    QCOMPARE(packed.size(), mesh.vertices.size() * format.stride());
+}
+void HotPaths::packIndices()
+{
+    QFETCH(int, segments);
+    const MeshData mesh = MeshGenerator::sphere(segments);
+    const GLenum type = chooseIndexType(mesh.vertices.size());
+    QByteArray packed;
+    QBENCHMARK {
+        packed = ::packIndices(mesh.indices.constData(), GL_UNSIGNED_INT, mesh.indices.size(), type);
+    }
+}
+void HotPaths::optimizeMesh()
+{
+    QFETCH(int, segments);
+    const MeshData mesh = MeshGenerator::sphere(segments);
+    MeshData optimized;
+    QBENCHMARK {
+        optimized = mesh;
+        MeshOptimizer::optimize(optimized);
+    }
+    QVERIFY(optimized.optimization.acmrAfter <= optimized.optimization.acmrBefore);
+}
+
+QTEST_GUILESS_MAIN(HotPaths)
+
+#include "tst_hotpaths.moc"
@@ -0,0 +1,145 @@
+#include "bvh.h"
+
+#include <algorithm>
+#include <cfloat>
+
+Frustum Frustum::fromMatrix(const QMatrix4x4 &viewProjection)
+{
+    // Gribb/Hartmann: each clip plane is the w row plus or minus one of the others
+    const QVector4D x = viewProjection.row(0);
+    const QVector4D y = viewProjection.row(1);
+    const QVector4D z = viewProjection.row(2);
+    const QVector4D w = viewProjection.row(3);
+    Frustum frustum;
+    frustum.planes[0] = w + x;
+    frustum.planes[1] = w - x;
+    frustum.planes[2] = w + y;
+    frustum.planes[3] = w - y;
+    frustum.planes[4] = w + z;
+    frustum.planes[5] = w - z;
+    for (QVector4D &plane : frustum.planes)
+        plane /= plane.toVector3D().length();
+    return frustum;
+}
+
+bool Frustum::intersectsSphere(const QVector3D &center, float radius) const
+{
+    for (const QVector4D &plane : planes) {
+        if (plane.x() * center.x() + plane.y() * center.y() + plane.z() * center.z() + plane.w() < -radius)
+            return false;
+    }
+    return true;
+}
+
+Bvh::Bvh()
+{}
+
+void Bvh::clear()
+{
+    m_nodes.clear();
+    m_items.clear();
+    m_spheres.clear();
+}
+
+void Bvh::build(const QVector<QVector4D> &spheres)
+{
+    clear();
+    m_items.resize(spheres.size());
+    for (int i = 0; i < spheres.size(); i++)
+        m_items[i] = i;
+    if (spheres.isEmpty())
+        return;
+    // A binary tree with leaves of up to LeafSize items has fewer than 2n / LeafSize + 1 nodes
+    m_nodes.reserve(2 * spheres.size() / LeafSize + 1);
+    buildNode(spheres, 0, spheres.size());
+    m_spheres.resize(spheres.size());
+    for (int i = 0; i < m_items.size(); i++)
+        m_spheres[i] = spheres[m_items[i]];
+}
+
+int Bvh::buildNode(const QVector<QVector4D> &spheres, int first, int count)
+{
+    Node node;
+    float centerMin[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    float centerMax[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (int c = 0; c < 3; c++) {
+        node.min[c] = FLT_MAX;
+        node.max[c] = -FLT_MAX;
+    }
+    for (int i = first; i < first + count; i++) {
+        const QVector4D &sphere = spheres[m_items[i]];
+        for (int c = 0; c < 3; c++) {
+            node.min[c] = qMin(node.min[c], sphere[c] - sphere.w());
+            node.max[c] = qMax(node.max[c], sphere[c] + sphere.w());
+            centerMin[c] = qMin(centerMin[c], sphere[c]);
+            centerMax[c] = qMax(centerMax[c], sphere[c]);
+        }
+    }
+    node.first = first;
+    node.count = count;
+    node.right = -1;
+    const int index = m_nodes.size();
+    m_nodes.append(node);
+    if (count <= LeafSize)
+        return index;
+
+    // Median split along the axis the centers spread the most
+    int axis = 0;
+    for (int c = 1; c < 3; c++)
+        if (centerMax[c] - centerMin[c] > centerMax[axis] - centerMin[axis])
+            axis = c;
+    const int half = count / 2;
+    std::nth_element(m_items.begin() + first, m_items.begin() + first + half, m_items.begin() + first + count,
+                     [&spheres, axis](int a, int b) { return spheres[a][axis] < spheres[b][axis]; });
+    buildNode(spheres, first, half);
+    const int right = buildNode(spheres, first + half, count - half);
+    m_nodes[index].right = right;
+    return index;
+}
+
+void Bvh::cull(const Frustum &frustum, QVector<int> &visible) const
+{
+    if (m_nodes.isEmpty())
+        return;
+    int stack[64];
+    int top = 0;
+    stack[top++] = 0;
+    while (top > 0) {
+        const Node &node = m_nodes[stack[--top]];
+        bool outside = false;
+        bool inside = true;
+        for (const QVector4D &plane : frustum.planes) {
+            // Box corners farthest along and against the plane normal
+            float farthest = plane.w(), nearest = plane.w();
+            for (int c = 0; c < 3; c++) {
+                farthest += plane[c] * (plane[c] > 0.0f ? node.max[c] : node.min[c]);
+                nearest += plane[c] * (plane[c] > 0.0f ? node.min[c] : node.max[c]);
+            }
+            if (farthest < 0.0f) {
+                outside = true;
+                break;
+            }
+            if (nearest < 0.0f)
+                inside = false;
+        }
+        if (outside)
+            continue;
+        if (inside) {
+            for (int i = node.first; i < node.first + node.count; i++)
+                visible.append(m_items[i]);
+        }
+        else if (node.right < 0) {
+            for (int i = node.first; i < node.first + node.count; i++) {
+                const QVector4D &sphere = m_spheres[i];
+                if (frustum.intersectsSphere(sphere.toVector3D(), sphere.w()))
+                    visible.append(m_items[i]);
+            }
+        }
+        else {
+            // Depth is about log2(n / LeafSize), far below the stack size for any sane n
+            const int self = int(&node - m_nodes.constData());
+            stack[top++] = node.right;
+            stack[top++] = self + 1;
+        }
+    }
+}
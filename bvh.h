@@ -0,0 +1,52 @@
+#ifndef BVH_H
+#define BVH_H
+
+#include <QMatrix4x4>
+#include <QVector>
+#include <QVector3D>
+#include <QVector4D>
+
+// Six planes pointing inwards, taken from a projection * view matrix
+struct Frustum
+{
+    QVector4D planes[6];
+
+    static Frustum fromMatrix(const QMatrix4x4 &viewProjection);
+    bool intersectsSphere(const QVector3D &center, float radius) const;
+};
+
+// Bounding volume hierarchy over spheres, stored as a flat depth-first node array.
+// Rebuild it when spheres move; culling then touches only the nodes near the frustum
+// and takes whole subtrees that are inside without testing their spheres.
+class Bvh
+{
+public:
+    Bvh();
+
+    void clear();
+    void build(const QVector<QVector4D> &spheres); // xyz - center, w - radius
+    // Appends the indices of the spheres that touch the frustum, in no particular order
+    void cull(const Frustum &frustum, QVector<int> &visible) const;
+
+    int size() const { return m_items.size(); }
+    int nodeCount() const { return m_nodes.size(); }
+
+private:
+    enum { LeafSize = 4 };
+
+    struct Node {
+        float min[3];
+        float max[3];
+        int first; // range in m_items covered by the subtree
+        int count;
+        int right; // second child, the first one follows the node; -1 for leaves
+    };
+
+    QVector<Node> m_nodes;
+    QVector<int> m_items;        // sphere indices in tree order
+    QVector<QVector4D> m_spheres; // spheres in tree order, leaves read them linearly
+
+    int buildNode(const QVector<QVector4D> &spheres, int first, int count);
+};
+
+#endif // BVH_H
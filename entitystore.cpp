@@ -0,0 +1,77 @@
+#include "entitystore.h"
+
+EntityStore::EntityStore()
+{
+    m_version = 0;
+}
+
+int EntityStore::add(int mesh, int material, const QVector3D &position,
+                     const QQuaternion &rotation, const QVector3D &scale)
+{
+    int handle;
+    if (!m_free_handles.isEmpty()) {
+        handle = m_free_handles.takeLast();
+    }
+    else {
+        handle = m_slots.size();
+        m_slots.append(-1);
+    }
+    m_slots[handle] = m_positions.size();
+    m_handles.append(handle);
+    m_positions.append(position);
+    m_rotations.append(rotation);
+    m_scales.append(scale);
+    m_meshes.append(quint16(mesh));
+    m_materials.append(quint16(material));
+    m_version++;
+    return handle;
+}
+bool EntityStore::remove(int handle)
+{
+    if (!contains(handle))
+        return false;
+    // Move the last object into the hole so the columns stay dense
+    const int slot = m_slots[handle];
+    const int last = m_positions.size() - 1;
+    if (slot != last) {
+        m_positions[slot] = m_positions[last];
+        m_rotations[slot] = m_rotations[last];
+        m_scales[slot] = m_scales[last];
+        m_meshes[slot] = m_meshes[last];
+        m_materials[slot] = m_materials[last];
+        m_handles[slot] = m_handles[last];
+        m_slots[m_handles[slot]] = slot;
+    }
+    m_positions.removeLast();
+    m_rotations.removeLast();
+    m_scales.removeLast();
+    m_meshes.removeLast();
+    m_materials.removeLast();
+    m_handles.removeLast();
+    m_slots[handle] = -1;
+    m_free_handles.append(handle);
+    m_version++;
+    return true;
+}
+void EntityStore::clear()
+{
+    m_positions.clear();
+    m_rotations.clear();
+    m_scales.clear();
+    m_meshes.clear();
+    m_materials.clear();
+    m_handles.clear();
+    m_slots.clear();
+    m_free_handles.clear();
+    m_version++;
+}
+void EntityStore::setTransform(int handle, const QVector3D &position, const QQuaternion &rotation, const QVector3D &scale)
+{
+    if (!contains(handle))
+        return;
+    const int slot = m_slots[handle];
+    m_positions[slot] = position;
+    m_rotations[slot] = rotation;
+    m_scales[slot] = scale;
+    m_version++;
+}
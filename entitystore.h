@@ -0,0 +1,48 @@
+#ifndef ENTITYSTORE_H
+#define ENTITYSTORE_H
+
+#include <QQuaternion>
+#include <QVector>
+#include <QVector3D>
+
+// Scene objects as parallel columns, one entry per object in a dense range [0, size()).
+// Per-frame passes walk the columns linearly; a removed object is replaced by the last one,
+// so slots move and code that keeps objects across frames holds handles instead.
+class EntityStore
+{
+public:
+    EntityStore();
+
+    // Returns a handle that stays valid until the object is removed
+    int add(int mesh, int material, const QVector3D &position,
+            const QQuaternion &rotation = QQuaternion(), const QVector3D &scale = QVector3D(1.0f, 1.0f, 1.0f));
+    bool remove(int handle);
+    void clear();
+    bool contains(int handle) const { return handle >= 0 && handle < m_slots.size() && m_slots[handle] >= 0; }
+    void setTransform(int handle, const QVector3D &position, const QQuaternion &rotation, const QVector3D &scale);
+
+    int size() const { return m_positions.size(); }
+    int slot(int handle) const { return m_slots[handle]; }
+    int handle(int slot) const { return m_handles[slot]; }
+    // Columns, indexed by slot
+    const QVector3D *positions() const { return m_positions.constData(); }
+    const QQuaternion *rotations() const { return m_rotations.constData(); }
+    const QVector3D *scales() const { return m_scales.constData(); }
+    const quint16 *meshes() const { return m_meshes.constData(); }
+    const quint16 *materials() const { return m_materials.constData(); }
+    // Changes whenever an object is added, removed or moved
+    quint32 version() const { return m_version; }
+
+private:
+    QVector<QVector3D> m_positions;
+    QVector<QQuaternion> m_rotations;
+    QVector<QVector3D> m_scales;
+    QVector<quint16> m_meshes;
+    QVector<quint16> m_materials;
+    QVector<int> m_handles; // slot -> handle
+    QVector<int> m_slots;   // handle -> slot, -1 - free
+    QVector<int> m_free_handles;
+    quint32 m_version;
+};
+
+#endif // ENTITYSTORE_H
@@ -0,0 +1,187 @@
+#include "framecapture.h"
+
+#include <QDir>
+#include <QFile>
+#include <QImage>
+#include <QtConcurrent/QtConcurrentRun>
+#include <cstring>
+
+// Encoding is the slow part; two threads keep up with PNG at 720p60 on a desktop CPU
+static const int WriterThreads = 2;
+
+static bool writeFrame(QByteArray pixels, int width, int height, QString path, FrameCapture::Format format)
+{
+    // GL rows go bottom-up
+    const QImage frame = QImage(reinterpret_cast<const uchar *>(pixels.constData()), width, height,
+                                4 * width, QImage::Format_RGBX8888).mirrored();
+    bool ok;
+    if (format == FrameCapture::Png) {
+        ok = frame.save(path, "PNG");
+    }
+    else {
+        QFile file(path);
+        const qint64 bytes = qint64(frame.bytesPerLine()) * frame.height();
+        ok = file.open(QIODevice::WriteOnly | QIODevice::Truncate)
+             && file.write(reinterpret_cast<const char *>(frame.constBits()), bytes) == bytes;
+    }
+    if (!ok)
+        qWarning("Can't write the captured frame %s", qPrintable(path));
+    return ok;
+}
+
+FrameCapture::FrameCapture()
+{
+    for (Slot &slot : m_slots) {
+        slot.buffer = 0;
+        slot.capacity = 0;
+        slot.fence = nullptr;
+        slot.width = slot.height = 0;
+        slot.frame = 0;
+    }
+    m_next = 0;
+    m_active = false;
+    m_format = Png;
+    m_frame = 0;
+    m_stats.frames = m_stats.written = m_stats.dropped = m_stats.waits = 0;
+    m_writers.setMaxThreadCount(WriterThreads);
+}
+FrameCapture::~FrameCapture()
+{
+    m_writers.waitForDone();
+}
+
+void FrameCapture::initialize()
+{
+    initializeOpenGLFunctions();
+    for (Slot &slot : m_slots)
+        glGenBuffers(1, &slot.buffer);
+}
+void FrameCapture::cleanup()
+{
+    stop();
+    for (Slot &slot : m_slots) {
+        glDeleteBuffers(1, &slot.buffer);
+        slot.buffer = 0;
+        slot.capacity = 0;
+    }
+    m_writers.waitForDone();
+}
+bool FrameCapture::start(const QString &directory, Format format)
+{
+    stop();
+    if (!QDir().mkpath(directory)) {
+        qWarning("Can't create the capture directory %s", qPrintable(directory));
+        return false;
+    }
+    m_directory = directory;
+    m_format = format;
+    m_frame = 0;
+    m_stats.frames = m_stats.dropped = m_stats.waits = 0;
+    m_written.store(0);
+    m_active = true;
+    return true;
+}
+void FrameCapture::stop()
+{
+    if (!m_active)
+        return;
+    collect(true);
+    m_active = false;
+}
+FrameCapture::Stats FrameCapture::stats() const
+{
+    Stats stats = m_stats;
+    stats.written = m_written.load();
+    return stats;
+}
+bool FrameCapture::formatFromName(const QString &name, Format &format)
+{
+    if (name == "png")
+        format = Png;
+    else if (name == "raw")
+        format = Raw;
+    else
+        return false;
+    return true;
+}
+
+void FrameCapture::capture(int width, int height)
+{
+    if (!m_active || width <= 0 || height <= 0)
+        return;
+    collect(false);
+    Slot &slot = m_slots[m_next];
+    if (slot.fence) {
+        // The GPU is Slots frames behind, only now does capturing cost a stall
+        m_stats.waits++;
+        retrieve(slot);
+    }
+    const qint64 bytes = qint64(width) * height * 4;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    if (slot.capacity < bytes) {
+        glBufferData(GL_PIXEL_PACK_BUFFER, bytes, nullptr, GL_STREAM_READ);
+        slot.capacity = bytes;
+    }
+    // RGBA bytes are the format drivers read back without conversion; rows are always aligned
+    glPixelStorei(GL_PACK_ALIGNMENT, 4);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    slot.width = width;
+    slot.height = height;
+    slot.frame = m_frame++;
+    m_next = (m_next + 1) % Slots;
+}
+void FrameCapture::collect(bool wait)
+{
+    // Oldest first, so frames reach the writers in order
+    for (int i = 0; i < Slots; i++) {
+        Slot &slot = m_slots[(m_next + i) % Slots];
+        if (!slot.fence)
+            continue;
+        if (!wait) {
+            const GLenum status = glClientWaitSync(slot.fence, 0, 0);
+            if (status != GL_ALREADY_SIGNALED && status != GL_CONDITION_SATISFIED)
+                return;
+        }
+        retrieve(slot);
+    }
+}
+void FrameCapture::retrieve(Slot &slot)
+{
+    while (glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000) == GL_TIMEOUT_EXPIRED) {}
+    glDeleteSync(slot.fence);
+    slot.fence = nullptr;
+    m_stats.frames++;
+
+    if (m_queued.load() >= MaxQueued) {
+        m_stats.dropped++;
+        return;
+    }
+    const qint64 bytes = qint64(slot.width) * slot.height * 4;
+    QByteArray pixels(int(bytes), Qt::Uninitialized);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer);
+    const void *mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, bytes, GL_MAP_READ_BIT);
+    if (mapped)
+        memcpy(pixels.data(), mapped, size_t(bytes));
+    const bool ok = mapped && glUnmapBuffer(GL_PIXEL_PACK_BUFFER) == GL_TRUE;
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    if (!ok) {
+        qWarning("Can't map the captured frame %d", slot.frame);
+        m_stats.dropped++;
+        return;
+    }
+
+    const QString name = m_format == Png
+        ? QString("frame_%1.png").arg(slot.frame, 6, 10, QChar('0'))
+        : QString("frame_%1_%2x%3.rgba").arg(slot.frame, 6, 10, QChar('0')).arg(slot.width).arg(slot.height);
+    const QString path = QDir(m_directory).filePath(name);
+    const int width = slot.width, height = slot.height;
+    const Format format = m_format;
+    m_queued.ref();
+    QtConcurrent::run(&m_writers, [this, pixels, width, height, path, format]() {
+        if (writeFrame(pixels, width, height, path, format))
+            m_written.ref();
+        m_queued.deref();
+    });
+}
@@ -0,0 +1,71 @@
+#ifndef FRAMECAPTURE_H
+#define FRAMECAPTURE_H
+
+#include <QAtomicInt>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QString>
+#include <QThreadPool>
+
+// Saves every drawn frame to an image sequence without stalling the GPU. capture() issues
+// glReadPixels into one of Slots pixel pack buffers and fences it; a buffer is mapped only
+// once its fence has signalled, which is normally a frame or two later, and then only when
+// the ring wraps around would the CPU wait. The pixels are copied out of the mapping and
+// encoded on writer threads, so the render loop pays for one memcpy per frame. When the
+// writers fall MaxQueued frames behind, new frames are dropped instead of queued.
+class FrameCapture : protected QOpenGLFunctions_3_3_Core
+{
+public:
+    enum Format { Png, Raw };
+    enum { Slots = 3, MaxQueued = 8 };
+
+    struct Stats {
+        int frames;  // read back
+        int written;
+        int dropped; // writers were too far behind
+        int waits;   // capture() found the next buffer still in flight
+    };
+
+    FrameCapture();
+    ~FrameCapture();
+
+    // All of these need a current GL 3.3 context
+    void initialize();
+    void cleanup();
+    // Frames go to directory as frame_NNNNNN.png, or top-down RGBA bytes in
+    // frame_NNNNNN_WxH.rgba for Raw
+    bool start(const QString &directory, Format format);
+    // Waits for the frames still in flight and hands them to the writers
+    void stop();
+    bool active() const { return m_active; }
+    // Call after the frame is drawn, with its framebuffer bound for reading
+    void capture(int width, int height);
+
+    Stats stats() const;
+    static bool formatFromName(const QString &name, Format &format);
+
+private:
+    struct Slot {
+        GLuint buffer;
+        qint64 capacity;
+        GLsync fence; // nullptr - nothing in flight
+        int width;
+        int height;
+        int frame;
+    };
+    Slot m_slots[Slots];
+    int m_next; // slot the next capture() writes, the oldest one in flight
+    bool m_active;
+    QString m_directory;
+    Format m_format;
+    int m_frame;
+    Stats m_stats;
+
+    QThreadPool m_writers;
+    QAtomicInt m_queued;
+    QAtomicInt m_written;
+
+    void collect(bool wait);
+    void retrieve(Slot &slot);
+};
+
+#endif // FRAMECAPTURE_H
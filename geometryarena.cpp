@@ -0,0 +1,334 @@
+#include "geometryarena.h"
+
+#include <QFloat16>
+#include <cstddef>
+#include <cstring>
+
+enum {
+    MinVertexCapacity = 4096,
+    MinIndexCapacity = 64 * 1024
+};
+
+static int indexSize(GLenum type)
+{
+    return type == GL_UNSIGNED_BYTE ? 1 : type == GL_UNSIGNED_SHORT ? 2 : 4;
+}
+
+// Index ranges start 4-byte aligned whatever their type
+static qint64 alignIndices(qint64 bytes)
+{
+    return (bytes + 3) & ~qint64(3);
+}
+
+static GLuint vertexOffset(GLuint location)
+{
+    switch (location) {
+    case 0: return offsetof(Vertex, position);
+    case 1: return offsetof(Vertex, color);
+    case 2: return offsetof(Vertex, texCoord);
+    }
+    return offsetof(Vertex, material);
+}
+
+static const GLint vertexComponents[4] = { 3, 3, 2, 1 };
+
+static bool isVertexLayout(const MeshView &mesh)
+{
+    if (mesh.vertexStride != GLsizei(sizeof(Vertex)) || mesh.attributes.size() != 4)
+        return false;
+    for (const VertexAttribute &attribute : mesh.attributes) {
+        if (attribute.location > 3 || attribute.type != GL_FLOAT
+                || attribute.components != vertexComponents[attribute.location]
+                || attribute.offset != vertexOffset(attribute.location))
+            return false;
+    }
+    return true;
+}
+
+// Repacks float attributes at locations 0-3 into Vertex, missing ones get the MeshLoader defaults
+static bool toVertices(const MeshView &mesh, QVector<Vertex> &vertices)
+{
+    const int count = int(mesh.vertexBytes / mesh.vertexStride);
+    if (isVertexLayout(mesh)) {
+        vertices.resize(count);
+        memcpy(vertices.data(), mesh.vertices, size_t(count) * sizeof(Vertex));
+        return true;
+    }
+    Vertex blank;
+    memset(&blank, 0, sizeof(blank));
+    blank.color[0] = blank.color[1] = blank.color[2] = 1.0f;
+    vertices.fill(blank, count);
+    const uchar *src = static_cast<const uchar *>(mesh.vertices);
+    for (const VertexAttribute &attribute : mesh.attributes) {
+        if (attribute.location > 3 || attribute.type != GL_FLOAT)
+            return false;
+        size_t bytes = size_t(qMin(attribute.components, vertexComponents[attribute.location])) * sizeof(GLfloat);
+        GLuint offset = vertexOffset(attribute.location);
+        for (int i = 0; i < count; i++)
+            memcpy(reinterpret_cast<uchar *>(&vertices[i]) + offset, src + qint64(i) * mesh.vertexStride + attribute.offset, bytes);
+    }
+    return true;
+}
+
+// Position of a packed vertex, it is always the first attribute
+static QVector3D packedPosition(const VertexFormat &format, const uchar *vertex)
+{
+    if (format.position == VertexFormat::PositionHalf) {
+        qfloat16 half[3];
+        memcpy(half, vertex, sizeof(half));
+        return QVector3D(half[0], half[1], half[2]);
+    }
+    GLfloat position[3];
+    memcpy(position, vertex, sizeof(position));
+    return QVector3D(position[0], position[1], position[2]);
+}
+
+// Bounds of what the GPU will draw, read from the packed vertices
+static void computeBounds(const VertexFormat &format, const uchar *vertices, qint64 count, GeometryArena::Range &range)
+{
+    const GLsizei stride = format.stride();
+    QVector3D lo, hi;
+    for (qint64 i = 0; i < count; i++) {
+        const QVector3D position = packedPosition(format, vertices + i * stride);
+        for (int c = 0; c < 3; c++) {
+            lo[c] = i ? qMin(lo[c], position[c]) : position[c];
+            hi[c] = i ? qMax(hi[c], position[c]) : position[c];
+        }
+    }
+    range.boundsMin = lo;
+    range.boundsMax = hi;
+    const QVector3D center = (range.boundsMin + range.boundsMax) / 2.0f;
+    range.radius = 0.0f;
+    for (qint64 i = 0; i < count; i++)
+        range.radius = qMax(range.radius, (packedPosition(format, vertices + i * stride) - center).length());
+}
+
+GeometryArena::GeometryArena()
+{
+    m_ebo = 0;
+    m_index_capacity = m_index_used = 0;
+    m_instance_buffer = 0;
+    m_bytes_used = m_bytes_unpacked = 0;
+}
+
+void GeometryArena::initialize()
+{
+    initializeOpenGLFunctions();
+}
+
+void GeometryArena::cleanup()
+{
+    for (Pool &pool : m_pools) {
+        glDeleteVertexArrays(1, &pool.vao);
+        glDeleteBuffers(1, &pool.vbo);
+    }
+    m_pools.clear();
+    glDeleteBuffers(1, &m_ebo);
+    m_ebo = 0;
+    m_index_capacity = m_index_used = 0;
+    m_ranges.clear();
+    m_live.clear();
+    m_bytes_used = m_bytes_unpacked = 0;
+}
+
+void GeometryArena::setInstanceBuffer(GLuint buffer)
+{
+    m_instance_buffer = buffer;
+    for (const Pool &pool : m_pools)
+        bindBuffers(pool);
+}
+
+int GeometryArena::add(const MeshView &mesh)
+{
+    VertexFormat format;
+    const uchar *vertexData;
+    qint64 vertexCount;
+    const void *indexData;
+    GLenum indexType;
+    QByteArray packed, packedIndices;
+    if (VertexFormat::fromLayout(mesh.vertexStride, mesh.attributes, format)) {
+        // Packed already (a mesh cache entry): the blobs go to the GPU as they are
+        vertexData = static_cast<const uchar *>(mesh.vertices);
+        vertexCount = mesh.vertexBytes / mesh.vertexStride;
+        indexData = mesh.indices;
+        indexType = mesh.indexType;
+    }
+    else {
+        QVector<Vertex> vertices;
+        if (!toVertices(mesh, vertices))
+            return -1;
+        format = VertexFormat::choose(vertices);
+        packed = format.pack(vertices);
+        indexType = chooseIndexType(vertices.size());
+        packedIndices = packIndices(mesh.indices, mesh.indexType, mesh.indexCount, indexType);
+        vertexData = reinterpret_cast<const uchar *>(packed.constData());
+        vertexCount = vertices.size();
+        indexData = packedIndices.constData();
+    }
+    const qint64 vertexBytes = vertexCount * format.stride();
+    const qint64 indexBytes = qint64(mesh.indexCount) * indexSize(indexType);
+
+    const int poolIndex = pool(format);
+    if (m_pools[poolIndex].used + vertexCount > m_pools[poolIndex].capacity)
+        growVertices(m_pools[poolIndex], vertexCount);
+    if (alignIndices(m_index_used) + indexBytes > m_index_capacity)
+        growIndices(indexBytes);
+    Pool &pool = m_pools[poolIndex];
+
+    Range range;
+    range.pool = poolIndex;
+    range.baseVertex = GLint(pool.used);
+    range.vertexCount = GLsizei(vertexCount);
+    range.indexOffset = qintptr(alignIndices(m_index_used));
+    range.indexCount = mesh.indexCount;
+    range.indexType = indexType;
+    computeBounds(format, vertexData, vertexCount, range);
+
+    // Copy targets, so the element buffer binding of whatever VAO is bound stays untouched
+    glBindBuffer(GL_COPY_WRITE_BUFFER, pool.vbo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, pool.used * format.stride(), vertexBytes, vertexData);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, m_ebo);
+    glBufferSubData(GL_COPY_WRITE_BUFFER, range.indexOffset, indexBytes, indexData);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+    pool.used += vertexCount;
+    m_index_used = range.indexOffset + indexBytes;
+    m_bytes_used += vertexBytes + indexBytes;
+    m_bytes_unpacked += vertexCount * qint64(sizeof(Vertex)) + mesh.indexCount * qint64(sizeof(GLuint));
+
+    int handle = m_live.indexOf(false);
+    if (handle < 0) {
+        handle = m_ranges.size();
+        m_ranges.append(range);
+        m_live.append(true);
+    }
+    else {
+        m_ranges[handle] = range;
+        m_live[handle] = true;
+    }
+    return handle;
+}
+
+void GeometryArena::remove(int handle)
+{
+    if (handle < 0 || !m_live[handle])
+        return;
+    m_live[handle] = false;
+    const Range &range = m_ranges[handle];
+    Pool &pool = m_pools[range.pool];
+    const qint64 indexBytes = range.indexCount * indexSize(range.indexType);
+    m_bytes_used -= range.vertexCount * qint64(pool.format.stride()) + indexBytes;
+    m_bytes_unpacked -= range.vertexCount * qint64(sizeof(Vertex)) + range.indexCount * qint64(sizeof(GLuint));
+    // The last mesh is given back right away, others wait for the next grow
+    if (range.baseVertex + range.vertexCount == pool.used)
+        pool.used = range.baseVertex;
+    if (range.indexOffset + indexBytes == m_index_used)
+        m_index_used = range.indexOffset;
+}
+
+int GeometryArena::pool(const VertexFormat &format)
+{
+    for (int i = 0; i < m_pools.size(); i++)
+        if (m_pools[i].format == format)
+            return i;
+    Pool pool;
+    pool.format = format;
+    glGenVertexArrays(1, &pool.vao);
+    pool.vbo = 0;
+    pool.capacity = pool.used = 0;
+    m_pools.append(pool);
+    return m_pools.size() - 1;
+}
+
+void GeometryArena::growVertices(Pool &pool, qint64 vertices)
+{
+    const int poolIndex = int(&pool - m_pools.data());
+    const qint64 stride = pool.format.stride();
+    qint64 live = 0;
+    for (int i = 0; i < m_ranges.size(); i++)
+        if (m_live[i] && m_ranges[i].pool == poolIndex)
+            live += m_ranges[i].vertexCount;
+    const qint64 capacity = qMax(qMax(2 * pool.capacity, qint64(MinVertexCapacity)), live + vertices);
+
+    GLuint vbo;
+    glGenBuffers(1, &vbo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, vbo);
+    glBufferData(GL_COPY_WRITE_BUFFER, capacity * stride, nullptr, GL_STATIC_DRAW);
+    // Live ranges are packed to the front on the GPU, holes left by remove() disappear
+    glBindBuffer(GL_COPY_READ_BUFFER, pool.vbo);
+    qint64 used = 0;
+    for (int i = 0; i < m_ranges.size(); i++) {
+        Range &range = m_ranges[i];
+        if (!m_live[i] || range.pool != poolIndex)
+            continue;
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, range.baseVertex * stride,
+                            used * stride, range.vertexCount * stride);
+        range.baseVertex = GLint(used);
+        used += range.vertexCount;
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glDeleteBuffers(1, &pool.vbo);
+    pool.vbo = vbo;
+    pool.capacity = capacity;
+    pool.used = used;
+    bindBuffers(pool);
+}
+
+void GeometryArena::growIndices(qint64 bytes)
+{
+    qint64 live = 0;
+    for (int i = 0; i < m_ranges.size(); i++)
+        if (m_live[i])
+            live += alignIndices(m_ranges[i].indexCount * indexSize(m_ranges[i].indexType));
+    const qint64 capacity = qMax(qMax(2 * m_index_capacity, qint64(MinIndexCapacity)), live + alignIndices(bytes));
+
+    GLuint ebo;
+    glGenBuffers(1, &ebo);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, ebo);
+    glBufferData(GL_COPY_WRITE_BUFFER, capacity, nullptr, GL_STATIC_DRAW);
+    glBindBuffer(GL_COPY_READ_BUFFER, m_ebo);
+    qint64 used = 0;
+    for (int i = 0; i < m_ranges.size(); i++) {
+        Range &range = m_ranges[i];
+        if (!m_live[i])
+            continue;
+        const qint64 size = range.indexCount * indexSize(range.indexType);
+        glCopyBufferSubData(GL_COPY_READ_BUFFER, GL_COPY_WRITE_BUFFER, range.indexOffset, used, size);
+        range.indexOffset = qintptr(used);
+        used = alignIndices(used + size);
+    }
+    glBindBuffer(GL_COPY_READ_BUFFER, 0);
+    glBindBuffer(GL_COPY_WRITE_BUFFER, 0);
+
+    glDeleteBuffers(1, &m_ebo);
+    m_ebo = ebo;
+    m_index_capacity = capacity;
+    m_index_used = used;
+    for (const Pool &pool : m_pools)
+        bindBuffers(pool);
+}
+
+void GeometryArena::bindBuffers(const Pool &pool)
+{
+    glBindVertexArray(pool.vao);
+    glBindBuffer(GL_ARRAY_BUFFER, pool.vbo);
+    const GLsizei stride = pool.format.stride();
+    for (const VertexAttribute &attribute : pool.format.attributes()) {
+        glVertexAttribPointer(attribute.location, attribute.components, attribute.type, attribute.normalized,
+                              stride, (void*)quintptr(attribute.offset));
+        glEnableVertexAttribArray(attribute.location);
+    }
+    if (m_instance_buffer) {
+        // mat4 attribute takes 4 locations, one column each
+        glBindBuffer(GL_ARRAY_BUFFER, m_instance_buffer);
+        for (GLuint i = 0; i < 4; i++) {
+            glVertexAttribPointer(4 + i, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(GLfloat), (void*)(i * 4 * sizeof(GLfloat)));
+            glEnableVertexAttribArray(4 + i);
+            glVertexAttribDivisor(4 + i, 1);
+        }
+    }
+    glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, m_ebo);
+    glBindVertexArray(0); // Unbind VAO
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
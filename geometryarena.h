@@ -0,0 +1,75 @@
+#ifndef GEOMETRYARENA_H
+#define GEOMETRYARENA_H
+
+#include "meshloader.h"
+#include "vertexformat.h"
+
+#include <QOpenGLFunctions_3_3_Core>
+#include <QVector>
+#include <QVector3D>
+
+// Vertex and index storage shared by every mesh. add() compiles each mesh to the smallest
+// VertexFormat and index type it fits, a mesh already in a VertexFormat layout (the mesh
+// cache stores them so) is uploaded straight from its memory. Meshes with the same format
+// share one vertex buffer and VAO (a pool), all of them share one index buffer. A removed mesh leaves a hole that
+// is squeezed out the next time its buffer has to grow.
+class GeometryArena : protected QOpenGLFunctions_3_3_Core
+{
+public:
+    // Where a mesh lives: bind vao(pool) and pass the rest to glDrawElements*BaseVertex
+    struct Range {
+        int pool;
+        GLint baseVertex;
+        GLsizei vertexCount;
+        qintptr indexOffset; // bytes into the index buffer
+        GLsizei indexCount;
+        GLenum indexType;
+        // Object space bounds; the sphere is centered on the box
+        QVector3D boundsMin;
+        QVector3D boundsMax;
+        float radius;
+    };
+
+    GeometryArena();
+
+    // All of these need a current GL 3.3 context
+    void initialize();
+    void cleanup();
+    // Locations 4-7 of every pool VAO read a mat4 per instance from this buffer, at offset 0
+    void setInstanceBuffer(GLuint buffer);
+    // Returns a handle for range(), -1 if the layout can't be converted
+    int add(const MeshView &mesh);
+    void remove(int handle);
+
+    const Range &range(int handle) const { return m_ranges[handle]; }
+    GLuint vao(int pool) const { return m_pools[pool].vao; }
+    // Memory held by live meshes, and what they would take as plain Vertex and 32-bit indices
+    qint64 bytesUsed() const { return m_bytes_used; }
+    qint64 bytesSaved() const { return m_bytes_unpacked - m_bytes_used; }
+
+private:
+    struct Pool {
+        VertexFormat format;
+        GLuint vao;
+        GLuint vbo;
+        qint64 capacity; // in vertices
+        qint64 used;
+    };
+
+    QVector<Pool> m_pools;
+    GLuint m_ebo;
+    qint64 m_index_capacity; // in bytes
+    qint64 m_index_used;
+    GLuint m_instance_buffer;
+    QVector<Range> m_ranges;
+    QVector<bool> m_live;
+    qint64 m_bytes_used;
+    qint64 m_bytes_unpacked;
+
+    int pool(const VertexFormat &format);
+    void growVertices(Pool &pool, qint64 vertices);
+    void growIndices(qint64 bytes);
+    void bindBuffers(const Pool &pool);
+};
+
+#endif // GEOMETRYARENA_H
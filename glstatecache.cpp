@@ -0,0 +1,88 @@
+#include "glstatecache.h"
+
+GlStateCache::GlStateCache()
+{
+    invalidate();
+    resetCounters();
+}
+
+void GlStateCache::initialize()
+{
+    initializeOpenGLFunctions();
+    invalidate();
+}
+void GlStateCache::invalidate()
+{
+    m_program = Unknown;
+    m_vao = Unknown;
+    m_active_unit = Unknown;
+    for (int unit = 0; unit < TextureUnits; unit++) {
+        m_texture_targets[unit] = GL_NONE;
+        m_textures[unit] = Unknown;
+    }
+    for (GLuint &buffer : m_uniform_buffers)
+        buffer = Unknown;
+}
+void GlStateCache::resetCounters()
+{
+    m_counters.issued = 0;
+    m_counters.skipped = 0;
+}
+bool GlStateCache::changes(GLuint &current, GLuint value)
+{
+    if (current == value) {
+        m_counters.skipped++;
+        return false;
+    }
+    current = value;
+    m_counters.issued++;
+    return true;
+}
+
+void GlStateCache::useProgram(GLuint program)
+{
+    if (changes(m_program, program))
+        glUseProgram(program);
+}
+void GlStateCache::bindVertexArray(GLuint vao)
+{
+    if (changes(m_vao, vao))
+        glBindVertexArray(vao);
+}
+void GlStateCache::bindTexture(GLuint unit, GLenum target, GLuint texture)
+{
+    if (unit >= TextureUnits) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        glBindTexture(target, texture);
+        m_active_unit = unit;
+        m_counters.issued += 2;
+        return;
+    }
+    // A unit has a binding per target; only one target per unit is tracked
+    if (m_texture_targets[unit] != target) {
+        m_texture_targets[unit] = target;
+        m_textures[unit] = Unknown;
+    }
+    if (m_textures[unit] == texture) {
+        m_counters.skipped++;
+        return;
+    }
+    if (m_active_unit != unit) {
+        glActiveTexture(GL_TEXTURE0 + unit);
+        m_active_unit = unit;
+        m_counters.issued++;
+    }
+    m_textures[unit] = texture;
+    m_counters.issued++;
+    glBindTexture(target, texture);
+}
+void GlStateCache::bindUniformBuffer(GLuint index, GLuint buffer)
+{
+    if (index >= UniformBuffers) {
+        glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer);
+        m_counters.issued++;
+        return;
+    }
+    if (changes(m_uniform_buffers[index], buffer))
+        glBindBufferBase(GL_UNIFORM_BUFFER, index, buffer);
+}
@@ -0,0 +1,46 @@
+#ifndef GLSTATECACHE_H
+#define GLSTATECACHE_H
+
+#include <QOpenGLFunctions_3_3_Core>
+
+// Remembers the program, VAO, texture and uniform buffer bindings it made and drops binds
+// that would change nothing. Binds made by anyone else (QPainter, GeometryArena,
+// TextureStreamer) are invisible to it, so call invalidate() after them.
+class GlStateCache : protected QOpenGLFunctions_3_3_Core
+{
+public:
+    struct Counters {
+        int issued;
+        int skipped;
+    };
+
+    GlStateCache();
+
+    // All of these need a current GL 3.3 context
+    void initialize();
+    // Forget everything, the next bind of each kind is issued
+    void invalidate();
+    void useProgram(GLuint program);
+    void bindVertexArray(GLuint vao);
+    void bindTexture(GLuint unit, GLenum target, GLuint texture);
+    void bindUniformBuffer(GLuint index, GLuint buffer);
+
+    const Counters &counters() const { return m_counters; }
+    void resetCounters();
+
+private:
+    enum { TextureUnits = 16, UniformBuffers = 8 };
+    static const GLuint Unknown = ~0u;
+
+    GLuint m_program;
+    GLuint m_vao;
+    GLuint m_active_unit;
+    GLenum m_texture_targets[TextureUnits];
+    GLuint m_textures[TextureUnits];
+    GLuint m_uniform_buffers[UniformBuffers];
+    Counters m_counters;
+
+    bool changes(GLuint &current, GLuint value);
+};
+
+#endif // GLSTATECACHE_H
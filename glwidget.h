@@ -5,6 +5,9 @@
 #include <QOpenGLFunctions_3_3_Core>
 #include <QOpenGLWidget>
 
+#include "meshloader.h"
+#include "scenedriver.h"
+
 class GLWidget : public QOpenGLWidget, protected QOpenGLFunctions_3_3_Core
 {
     Q_OBJECT
@@ -21,13 +24,38 @@ public:
     QSize sizeHint() const override;
 
     void keyPressEvent(QKeyEvent *event) override; //Перемещён в public, т. к. вызывается из window
-    bool autoRotate;
+    bool autoRotate() const { return m_scene.autoRotate(); }
+
+    // Scene contents, see Renderer::addObject(). Handles stay valid until removed
+    int addObject(Renderer::MeshKind kind, const QVector3D &position, const QQuaternion &rotation = QQuaternion(),
+                  const QVector3D &scale = QVector3D(1.0f, 1.0f, 1.0f), int material = -1);
+    void removeObject(int handle);
+    void clearObjects();
+    int objectCount() const { return m_scene.renderer().objects().size(); }
+    void loadMesh(Renderer::MeshKind kind, const QString &path);
+
+    // See SceneDriver
+    bool startRecording(const QString &path);
+    bool startReplay(const QString &path);
+    void setCaptureTarget(const QString &directory, FrameCapture::Format format);
+
+signals:
+    void rotationTypeChanged();
 
 public slots:
+    // Nothing connects to these since input goes through SceneDriver, kept for API compatibility
     void setXRotation(int angle);
     void setYRotation(int angle);
     void setZRotation(int angle);
     void setRotationType();
+    void setInstancedRendering(bool enabled);
+    void setOcclusionCulling(bool enabled);
+    void setHudVisible(bool visible);
+    void setCapturing(bool enabled);
+    void setFrameRateCap(int fps); // 0 - no cap, vsync only
+
+private slots:
+    void scheduleFrame();
 
 /*signals:
     void xRotationChanged(int angle);
@@ -35,51 +63,19 @@ public slots:
     void zRotationChanged(int angle);*/
 
 protected:
-    void timerEvent(QTimerEvent *event) override;
     void mousePressEvent(QMouseEvent *event) override;
     void mouseMoveEvent(QMouseEvent *event) override;
     void wheelEvent(QWheelEvent* event) override;
 
 private:    
-    //For rotation using mouse
-    int m_xRot;
-    int m_yRot;
-    int m_zRot;
-    QPoint m_lastPos;
-    int timerId;
-
-    // Shader programms
-    QOpenGLShaderProgram m_prog_container;
-    QOpenGLShaderProgram m_prog_pyramid4;
-    QOpenGLShaderProgram m_prog_pyramid3;
-
-    // VAOs
-    GLuint m_vao_container_id;
-    GLuint m_vao_pyramid4_id;
-    GLuint m_vao_tower_id;
-    GLuint m_vao_pyramid3_id;
-
-    // Textures
-    GLuint m_texture_cube_id;
-    GLuint m_texture_triangle_id;
-    GLuint m_texture_wall_id;
-    GLuint m_texture_triangle2_id;
-
-    // Uniforms
-    //GLint  m_triangle_color_id;
-
-    QVector3D camera_pos;
-    QVector3D camera_up;
-    QVector3D camera_front;
-
-    QTime frame_delta_time;
-    QTime last_frame_time;
-
-    //Instead of time in paintGL
-    void noTime(int&, int&, int&);
-    int t_x;
-    int t_y;
-    int t_z;
+    SceneDriver m_scene;
+    MeshData m_pending_meshes[Renderer::MeshKindCount];
+    void liveInput(const InputEvent &input);
+
+    // Frame pacing
+    int m_fpsCap;
+    QTimer m_cap_timer;
+    QElapsedTimer m_frame_clock;
 };
 
 #endif // WIDGET_H
@@ -0,0 +1,111 @@
+#include "inputlog.h"
+#include "simulationclock.h"
+
+// "LW2I", then the format version and the tick rate the events were stamped at
+static const quint32 Magic = 0x4c573249;
+static const quint16 Version = 1;
+
+static QDataStream &operator<<(QDataStream &stream, const InputEvent &event)
+{
+    return stream << event.tick << event.type << event.key << event.text << event.x << event.y << event.buttons;
+}
+static QDataStream &operator>>(QDataStream &stream, InputEvent &event)
+{
+    return stream >> event.tick >> event.type >> event.key >> event.text >> event.x >> event.y >> event.buttons;
+}
+
+InputLog::InputLog()
+{
+    m_replaying = false;
+    m_next = 0;
+    m_end = 0;
+}
+InputLog::~InputLog()
+{
+    if (recording())
+        qWarning("Input recording closed without an end mark");
+}
+
+bool InputLog::startRecording(const QString &path)
+{
+    stop(0);
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+        qWarning("Can't write the input recording %s: %s", qPrintable(path), qPrintable(m_file.errorString()));
+        return false;
+    }
+    m_stream.setDevice(&m_file);
+    m_stream.setVersion(QDataStream::Qt_5_0);
+    m_stream << Magic << Version << quint16(SimulationClock::TicksPerSecond);
+    return true;
+}
+bool InputLog::startReplay(const QString &path)
+{
+    stop(0);
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        qWarning("Can't read the input recording %s: %s", qPrintable(path), qPrintable(file.errorString()));
+        return false;
+    }
+    QDataStream stream(&file);
+    stream.setVersion(QDataStream::Qt_5_0);
+    quint32 magic = 0;
+    quint16 version = 0, ticksPerSecond = 0;
+    stream >> magic >> version >> ticksPerSecond;
+    if (magic != Magic || version != Version || ticksPerSecond != SimulationClock::TicksPerSecond) {
+        qWarning("%s is not an input recording of this version", qPrintable(path));
+        return false;
+    }
+    QVector<InputEvent> events;
+    quint32 end = 0;
+    while (!stream.atEnd()) {
+        InputEvent event;
+        stream >> event;
+        if (stream.status() != QDataStream::Ok) {
+            qWarning("The input recording %s is truncated, replaying what was read", qPrintable(path));
+            break;
+        }
+        end = event.tick;
+        if (event.type == InputEvent::End)
+            break;
+        events.append(event);
+    }
+    m_events = events;
+    m_next = 0;
+    m_end = end;
+    m_replaying = true;
+    return true;
+}
+void InputLog::stop(quint32 tick)
+{
+    if (recording()) {
+        InputEvent end(InputEvent::End);
+        end.tick = tick;
+        append(end);
+        m_stream.setDevice(nullptr);
+        m_file.close();
+    }
+    m_replaying = false;
+    m_events.clear();
+    m_next = 0;
+}
+
+void InputLog::append(const InputEvent &event)
+{
+    if (!recording())
+        return;
+    m_stream << event;
+    // A crash still leaves everything up to the last event on disk
+    m_file.flush();
+}
+bool InputLog::next(quint32 tick, InputEvent &event)
+{
+    if (!m_replaying || m_next >= m_events.size() || m_events[m_next].tick > tick)
+        return false;
+    event = m_events[m_next++];
+    return true;
+}
+bool InputLog::finished(quint32 tick) const
+{
+    return m_replaying && m_next >= m_events.size() && tick >= m_end;
+}
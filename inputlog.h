@@ -0,0 +1,63 @@
+#ifndef INPUTLOG_H
+#define INPUTLOG_H
+
+#include <QDataStream>
+#include <QFile>
+#include <QString>
+#include <QVector>
+
+// One user input as SceneDriver applies it, stamped with the simulation tick it was applied at
+struct InputEvent
+{
+    enum Type {
+        Key,          // key, text
+        Wheel,        // x, y - angleDelta()
+        MousePress,   // x, y - position
+        MouseMove,    // x, y - position, buttons
+        RotationType, // switch between auto and manual rotation
+        End           // the recording stopped here
+    };
+
+    quint32 tick;
+    qint32 type;
+    qint32 key;
+    QString text; // Russian layout aliases are matched on the text
+    qint32 x;
+    qint32 y;
+    qint32 buttons;
+
+    InputEvent(Type type = End) : tick(0), type(type), key(0), x(0), y(0), buttons(0) {}
+};
+
+// Input of a session in the order it was applied. Recording writes every event to a file as
+// it happens; a replay loads such a file and hands the events back at their ticks, so a
+// replayed session goes through exactly the same states as the recorded one.
+class InputLog
+{
+public:
+    InputLog();
+    ~InputLog();
+
+    bool startRecording(const QString &path);
+    bool startReplay(const QString &path);
+    // Recording: marks tick as the end and closes the file. Replay: drops what is left
+    void stop(quint32 tick);
+    bool recording() const { return m_file.isOpen(); }
+    bool replaying() const { return m_replaying; }
+
+    void append(const InputEvent &event);
+    // Replay: the next event stamped with tick, false once there are no more for it
+    bool next(quint32 tick, InputEvent &event);
+    // Replay: tick is past the end of the recording
+    bool finished(quint32 tick) const;
+
+private:
+    QFile m_file;
+    QDataStream m_stream;
+    bool m_replaying;
+    QVector<InputEvent> m_events;
+    int m_next;
+    quint32 m_end;
+};
+
+#endif // INPUTLOG_H
@@ -1,10 +1,77 @@
 #include "window.h"
+#include "benchmark.h"
+#include "framecapture.h"
 #include <QApplication>
+#include <QCommandLineParser>
+#include <QSurfaceFormat>
+#include <cstring>
+
+static bool hasArgument(int argc, char *argv[], const char *name)
+{
+    for (int i = 1; i < argc; i++)
+        if (strcmp(argv[i], name) == 0)
+            return true;
+    return false;
+}
 
 int main(int argc, char *argv[])
 {
+    if (hasArgument(argc, argv, "--benchmark")) {
+        // No display (CI): render through the offscreen platform plugin
+        if (qEnvironmentVariableIsEmpty("QT_QPA_PLATFORM") && qEnvironmentVariableIsEmpty("DISPLAY"))
+            qputenv("QT_QPA_PLATFORM", "offscreen");
+        QGuiApplication a(argc, argv);
+        return runBenchmark(a.arguments());
+    }
+
+    // Swaps wait for vblank, this paces GLWidget's and RenderThread's frame loops
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+    format.setSwapInterval(1);
+    QSurfaceFormat::setDefaultFormat(format);
+
     QApplication a(argc, argv);
-    Window sec;
+    QCommandLineParser parser;
+    parser.addHelpOption();
+    QCommandLineOption fpsCapOption("fps-cap", "Limit the frame rate (0 - vsync only).", "fps", "0");
+    QCommandLineOption meshOption("mesh", "Replace a mesh type (containers, pyramid4, pyramid3, towers, spheres, tori) "
+                                  "with an OBJ or glTF file.", "kind=file");
+    QCommandLineOption recordOption("record", "Record keyboard, wheel and mouse input to a file.", "file");
+    QCommandLineOption replayOption("replay", "Replay recorded input, one simulation tick per frame.", "file");
+    QCommandLineOption captureOption("capture", "Save every frame to a directory from the start (C toggles it).", "directory");
+    QCommandLineOption captureFormatOption("capture-format", "Captured frame format: png or raw.", "format", "png");
+    QCommandLineOption renderThreadOption("render-thread", "Render on a thread of its own, not on the GUI thread.");
+    parser.addOption(fpsCapOption);
+    parser.addOption(meshOption);
+    parser.addOption(recordOption);
+    parser.addOption(replayOption);
+    parser.addOption(captureOption);
+    parser.addOption(captureFormatOption);
+    parser.addOption(renderThreadOption);
+    parser.process(a);
+    if (parser.isSet(recordOption) && parser.isSet(replayOption)) {
+        qCritical("--record and --replay can't be used together");
+        return 1;
+    }
+    FrameCapture::Format captureFormat;
+    if (!FrameCapture::formatFromName(parser.value(captureFormatOption), captureFormat)) {
+        qCritical("--capture-format must be png or raw");
+        return 1;
+    }
+
+    Window sec(parser.isSet(renderThreadOption));
+    sec.setFrameRateCap(parser.value(fpsCapOption).toInt());
+    sec.setCapture(parser.isSet(captureOption) ? parser.value(captureOption) : QString("capture"),
+                   captureFormat, parser.isSet(captureOption));
+    for (const QString &spec : parser.values(meshOption)) {
+        if (!sec.loadMesh(spec)) {
+            qCritical("Bad --mesh value: %s", qPrintable(spec));
+            return 1;
+        }
+    }
+    if (parser.isSet(recordOption) && !sec.recordInput(parser.value(recordOption)))
+        return 1;
+    if (parser.isSet(replayOption) && !sec.replayInput(parser.value(replayOption)))
+        return 1;
     sec.show();
     return a.exec();
 }
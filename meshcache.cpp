@@ -0,0 +1,254 @@
+#include "meshcache.h"
+
+#include <QCryptographicHash>
+#include <QDateTime>
+#include <QDir>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <cstring>
+#include <limits>
+
+namespace {
+
+const char meshMagic[8] = { 'L', 'W', '2', 'M', 'E', 'S', 'H', '\0' };
+
+enum {
+    MeshFileVersion = 3, // 2 - geometry is stored after MeshOptimizer, 3 - and packed
+    BlobAlignment = 64,
+    MaxAttributes = 16
+};
+
+struct MeshFileHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 attributeCount;
+    quint32 vertexStride;
+    quint32 indexType;
+    quint32 vertexFormat; // VertexFormat::code()
+    quint32 reserved;
+    quint64 vertexOffset;
+    quint64 vertexBytes;
+    quint64 indexOffset;
+    quint64 indexCount;
+    qint64 sourceSize;
+    qint64 sourceModified; // ms since epoch
+};
+
+struct MeshFileAttribute
+{
+    quint32 location;
+    quint32 components;
+    quint32 type;
+    quint32 normalized;
+    quint32 offset;
+};
+
+}
+
+static quint64 alignUp(quint64 value)
+{
+    return (value + BlobAlignment - 1) / BlobAlignment * BlobAlignment;
+}
+
+static int indexSize(GLenum type)
+{
+    switch (type) {
+    case GL_UNSIGNED_BYTE: return 1;
+    case GL_UNSIGNED_SHORT: return 2;
+    case GL_UNSIGNED_INT: return 4;
+    }
+    return 0;
+}
+
+// Bytes one attribute takes in a vertex, 0 for a type the renderer doesn't read
+static int attributeSize(GLenum type, int components)
+{
+    switch (type) {
+    case GL_UNSIGNED_BYTE: return components;
+    case GL_UNSIGNED_SHORT:
+    case GL_HALF_FLOAT: return 2 * components;
+    case GL_FLOAT: return 4 * components;
+    case GL_UNSIGNED_INT_2_10_10_10_REV: return components == 4 ? 4 : 0;
+    }
+    return 0;
+}
+
+// Every index addresses one of vertexCount vertices
+static bool indicesInRange(const uchar *indices, GLenum type, quint64 count, quint64 vertexCount)
+{
+    quint32 highest = 0;
+    for (quint64 i = 0; i < count; i++) {
+        quint32 index;
+        if (type == GL_UNSIGNED_BYTE) {
+            index = indices[i];
+        }
+        else if (type == GL_UNSIGNED_SHORT) {
+            quint16 value;
+            memcpy(&value, indices + 2 * i, sizeof(value));
+            index = value;
+        }
+        else {
+            memcpy(&index, indices + 4 * i, sizeof(index));
+        }
+        highest = qMax(highest, index);
+    }
+    return count == 0 || highest < vertexCount;
+}
+
+static bool fail(QString *error, const QString &message)
+{
+    if (error)
+        *error = message;
+    return false;
+}
+
+MappedMesh::MappedMesh()
+{
+    m_view.vertices = nullptr;
+    m_view.vertexBytes = 0;
+    m_view.vertexStride = 0;
+    m_view.indices = nullptr;
+    m_view.indexCount = 0;
+    m_view.indexType = GL_UNSIGNED_INT;
+    m_source_size = -1;
+    m_source_modified = -1;
+}
+
+bool MappedMesh::open(const QString &path, QString *error)
+{
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly))
+        return fail(error, m_file.errorString());
+    quint64 size = quint64(m_file.size());
+    if (size < sizeof(MeshFileHeader))
+        return fail(error, "truncated header");
+    const uchar *data = m_file.map(0, m_file.size());
+    if (!data)
+        return fail(error, m_file.errorString());
+
+    MeshFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, meshMagic, sizeof(meshMagic)) != 0 || header.version != MeshFileVersion)
+        return fail(error, "not a mesh cache file or an old version");
+    int bytesPerIndex = indexSize(header.indexType);
+    quint64 layoutEnd = sizeof(MeshFileHeader) + quint64(header.attributeCount) * sizeof(MeshFileAttribute);
+    if (header.attributeCount > MaxAttributes || !header.vertexStride || !bytesPerIndex
+            || header.vertexBytes % header.vertexStride != 0
+            || header.vertexOffset < layoutEnd || header.vertexOffset % BlobAlignment != 0
+            || header.vertexBytes > size - qMin(size, header.vertexOffset)
+            || header.indexOffset % BlobAlignment != 0
+            || header.indexCount > (size - qMin(size, header.indexOffset)) / bytesPerIndex
+            || header.indexCount > quint64(std::numeric_limits<GLsizei>::max()))
+        return fail(error, "corrupt header");
+
+    m_view.attributes.resize(header.attributeCount);
+    quint32 locations = 0;
+    for (quint32 i = 0; i < header.attributeCount; i++) {
+        MeshFileAttribute attribute;
+        memcpy(&attribute, data + sizeof(MeshFileHeader) + i * sizeof(MeshFileAttribute), sizeof(attribute));
+        // Known type, inside the stride, each location once
+        const int bytes = attribute.components >= 1 && attribute.components <= 4
+                ? attributeSize(attribute.type, int(attribute.components)) : 0;
+        if (!bytes || quint64(attribute.offset) + quint64(bytes) > header.vertexStride
+                || attribute.location >= MaxAttributes || (locations & (1u << attribute.location)))
+            return fail(error, "corrupt vertex layout");
+        locations |= 1u << attribute.location;
+        VertexAttribute &dst = m_view.attributes[i];
+        dst.location = attribute.location;
+        dst.components = GLint(attribute.components);
+        dst.type = attribute.type;
+        dst.normalized = attribute.normalized ? GL_TRUE : GL_FALSE;
+        dst.offset = attribute.offset;
+    }
+    // A stale or damaged file must not make the GPU fetch past the vertex blob
+    if (!indicesInRange(data + header.indexOffset, header.indexType, header.indexCount,
+                        header.vertexBytes / header.vertexStride))
+        return fail(error, "index out of range");
+
+    // The layout must be exactly the one its format packs
+    VertexFormat format;
+    if (!VertexFormat::fromCode(header.vertexFormat, format)
+            || !VertexFormat::fromLayout(GLsizei(header.vertexStride), m_view.attributes, format)
+            || format.code() != header.vertexFormat)
+        return fail(error, "vertex layout doesn't match its format");
+
+    m_view.vertices = data + header.vertexOffset;
+    m_view.vertexBytes = qint64(header.vertexBytes);
+    m_view.vertexStride = GLsizei(header.vertexStride);
+    m_view.indices = data + header.indexOffset;
+    m_view.indexCount = GLsizei(header.indexCount);
+    m_view.indexType = header.indexType;
+    m_source_size = header.sourceSize;
+    m_source_modified = header.sourceModified;
+    return true;
+}
+
+QString MeshCache::cachePath(const QString &sourcePath)
+{
+    QByteArray key = QCryptographicHash::hash(QFileInfo(sourcePath).absoluteFilePath().toUtf8(),
+                                              QCryptographicHash::Sha1).toHex();
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+            + "/meshes/" + QString::fromLatin1(key) + ".lw2mesh";
+}
+
+bool MeshCache::write(const QString &path, const MeshView &mesh, const QFileInfo &source, QString *error)
+{
+    VertexFormat format;
+    if (!VertexFormat::fromLayout(mesh.vertexStride, mesh.attributes, format))
+        return fail(error, "the mesh is not packed to a vertex format");
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    // QSaveFile renames on commit, so readers never map a half-written file
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly))
+        return fail(error, QString("%1: %2").arg(path, file.errorString()));
+
+    MeshFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, meshMagic, sizeof(meshMagic));
+    header.version = MeshFileVersion;
+    header.attributeCount = quint32(mesh.attributes.size());
+    header.vertexStride = quint32(mesh.vertexStride);
+    header.indexType = mesh.indexType;
+    header.vertexFormat = format.code();
+    header.vertexOffset = alignUp(sizeof(MeshFileHeader) + mesh.attributes.size() * sizeof(MeshFileAttribute));
+    header.vertexBytes = quint64(mesh.vertexBytes);
+    header.indexOffset = alignUp(header.vertexOffset + header.vertexBytes);
+    header.indexCount = quint64(mesh.indexCount);
+    header.sourceSize = source.size();
+    header.sourceModified = source.lastModified().toMSecsSinceEpoch();
+
+    QByteArray layout(reinterpret_cast<const char *>(&header), sizeof(header));
+    for (const VertexAttribute &attribute : mesh.attributes) {
+        MeshFileAttribute stored = { attribute.location, quint32(attribute.components), attribute.type,
+                                     quint32(attribute.normalized), attribute.offset };
+        layout.append(reinterpret_cast<const char *>(&stored), sizeof(stored));
+    }
+    layout.append(QByteArray(int(header.vertexOffset) - layout.size(), '\0'));
+    qint64 indexBytes = qint64(mesh.indexCount) * indexSize(mesh.indexType);
+
+    bool ok = file.write(layout) == layout.size()
+            && file.write(static_cast<const char *>(mesh.vertices), mesh.vertexBytes) == mesh.vertexBytes
+            && file.write(QByteArray(int(header.indexOffset - header.vertexOffset - header.vertexBytes), '\0')) >= 0
+            && file.write(static_cast<const char *>(mesh.indices), indexBytes) == indexBytes;
+    if (!ok || !file.commit())
+        return fail(error, QString("%1: %2").arg(path, file.errorString()));
+    return true;
+}
+
+QSharedPointer<MappedMesh> MeshCache::open(const QString &sourcePath)
+{
+    QFileInfo source(sourcePath);
+    QString path = cachePath(sourcePath);
+    if (!source.exists() || !QFile::exists(path))
+        return QSharedPointer<MappedMesh>();
+    QSharedPointer<MappedMesh> mesh(new MappedMesh);
+    QString error;
+    if (!mesh->open(path, &error)) {
+        qWarning("Mesh cache: %s: %s", qPrintable(path), qPrintable(error));
+        return QSharedPointer<MappedMesh>();
+    }
+    if (mesh->sourceSize() != source.size() || mesh->sourceModified() != source.lastModified().toMSecsSinceEpoch())
+        return QSharedPointer<MappedMesh>();
+    return mesh;
+}
@@ -0,0 +1,47 @@
+#ifndef MESHCACHE_H
+#define MESHCACHE_H
+
+#include "meshloader.h"
+#include "vertexformat.h"
+
+#include <QFile>
+#include <QFileInfo>
+
+// Read-only mapping of a binary mesh file. The file holds a header, the vertex layout and
+// 64-byte aligned vertex and index blobs in native byte order, already packed to their
+// VertexFormat and index type; view() points straight into the mapping, so an upload is a
+// single glBufferSubData per blob without intermediate copies.
+// open() checks the layout against the stride and every index against the vertex count,
+// a file failing either is treated as missing and rebuilt from the source.
+class MappedMesh
+{
+public:
+    MappedMesh();
+
+    bool open(const QString &path, QString *error = nullptr);
+    const MeshView &view() const { return m_view; }
+    qint64 sourceSize() const { return m_source_size; }
+    qint64 sourceModified() const { return m_source_modified; }
+
+private:
+    QFile m_file; // the mapping lives as long as the file object
+    MeshView m_view;
+    qint64 m_source_size;
+    qint64 m_source_modified;
+
+    Q_DISABLE_COPY(MappedMesh)
+};
+
+// Binary copies of parsed mesh files, kept in the user cache directory and keyed by the
+// source path. An entry is used only while the source size and modification time match.
+class MeshCache
+{
+public:
+    static QString cachePath(const QString &sourcePath);
+    // mesh must be packed: its layout one of VertexFormat's, see VertexFormat::fromLayout()
+    static bool write(const QString &path, const MeshView &mesh, const QFileInfo &source, QString *error = nullptr);
+    // Null if there is no up-to-date entry for sourcePath
+    static QSharedPointer<MappedMesh> open(const QString &sourcePath);
+};
+
+#endif // MESHCACHE_H
@@ -0,0 +1,129 @@
+#include "meshgenerator.h"
+
+#include <QHash>
+#include <QtMath>
+
+static const float SphereRadius = 0.5f;
+static const float TorusRadius = 0.35f;
+static const float TubeRadius = 0.15f;
+
+static Vertex makeVertex(float x, float y, float z, float u, float v)
+{
+    Vertex vertex;
+    vertex.position[0] = x;
+    vertex.position[1] = y;
+    vertex.position[2] = z;
+    vertex.color[0] = vertex.color[1] = vertex.color[2] = 1.0f;
+    vertex.texCoord[0] = u;
+    vertex.texCoord[1] = v;
+    vertex.material = 0.0f;
+    return vertex;
+}
+static void addTriangle(MeshData &mesh, GLuint a, GLuint b, GLuint c)
+{
+    mesh.indices.append(a);
+    mesh.indices.append(b);
+    mesh.indices.append(c);
+}
+
+MeshData MeshGenerator::sphere(int segments)
+{
+    segments = qMax(segments, 4);
+    const int rings = segments / 2;
+    MeshData mesh;
+    mesh.vertices.reserve((rings + 1) * (segments + 1));
+    // The seam column is doubled so it can have both texture coordinates
+    for (int ring = 0; ring <= rings; ring++) {
+        const float theta = float(M_PI) * ring / rings;
+        for (int segment = 0; segment <= segments; segment++) {
+            const float phi = 2.0f * float(M_PI) * segment / segments;
+            mesh.vertices.append(makeVertex(SphereRadius * qSin(theta) * qCos(phi),
+                                            SphereRadius * qCos(theta),
+                                            SphereRadius * qSin(theta) * qSin(phi),
+                                            float(segment) / segments, 1.0f - float(ring) / rings));
+        }
+    }
+    const int row = segments + 1;
+    for (int ring = 0; ring < rings; ring++) {
+        for (int segment = 0; segment < segments; segment++) {
+            const GLuint a = ring * row + segment;
+            const GLuint c = a + row;
+            // The rings at the poles are single points, their quads are triangles
+            if (ring > 0)
+                addTriangle(mesh, a, c, a + 1);
+            if (ring < rings - 1)
+                addTriangle(mesh, a + 1, c, c + 1);
+        }
+    }
+    return mesh;
+}
+MeshData MeshGenerator::torus(int segments)
+{
+    segments = qMax(segments, 4);
+    const int sides = qMax(segments / 2, 3);
+    MeshData mesh;
+    mesh.vertices.reserve((segments + 1) * (sides + 1));
+    for (int segment = 0; segment <= segments; segment++) {
+        const float u = 2.0f * float(M_PI) * segment / segments;
+        for (int side = 0; side <= sides; side++) {
+            const float v = 2.0f * float(M_PI) * side / sides;
+            const float distance = TorusRadius + TubeRadius * qCos(v);
+            // The texture wraps twice around the ring to keep its aspect
+            mesh.vertices.append(makeVertex(distance * qCos(u), TubeRadius * qSin(v), distance * qSin(u),
+                                            2.0f * segment / segments, float(side) / sides));
+        }
+    }
+    const int row = sides + 1;
+    for (int segment = 0; segment < segments; segment++) {
+        for (int side = 0; side < sides; side++) {
+            const GLuint a = segment * row + side;
+            const GLuint c = a + row;
+            addTriangle(mesh, a, c, a + 1);
+            addTriangle(mesh, a + 1, c, c + 1);
+        }
+    }
+    return mesh;
+}
+MeshData MeshGenerator::subdivide(const MeshData &mesh)
+{
+    MeshData result;
+    if (mesh.mapped || mesh.indices.size() % 3 != 0) {
+        result.error = "Only unmapped triangle lists can be subdivided";
+        return result;
+    }
+    result.vertices = mesh.vertices;
+    result.indices.reserve(4 * mesh.indices.size());
+    // Both triangles on an edge share its midpoint, so the result stays watertight
+    QHash<quint64, GLuint> midpoints;
+    auto midpoint = [&result, &midpoints](GLuint a, GLuint b) {
+        const quint64 edge = a < b ? (quint64(a) << 32) | b : (quint64(b) << 32) | a;
+        auto found = midpoints.constFind(edge);
+        if (found != midpoints.constEnd())
+            return found.value();
+        const Vertex &va = result.vertices.at(a);
+        const Vertex &vb = result.vertices.at(b);
+        Vertex vertex;
+        for (int i = 0; i < 3; i++) {
+            vertex.position[i] = 0.5f * (va.position[i] + vb.position[i]);
+            vertex.color[i] = 0.5f * (va.color[i] + vb.color[i]);
+        }
+        vertex.texCoord[0] = 0.5f * (va.texCoord[0] + vb.texCoord[0]);
+        vertex.texCoord[1] = 0.5f * (va.texCoord[1] + vb.texCoord[1]);
+        vertex.material = va.material; // flat attribute, not interpolated
+        const GLuint index = GLuint(result.vertices.size());
+        result.vertices.append(vertex);
+        midpoints.insert(edge, index);
+        return index;
+    };
+    const GLuint *indices = mesh.indices.constData();
+    for (int i = 0; i < mesh.indices.size(); i += 3) {
+        const GLuint a = indices[i], b = indices[i + 1], c = indices[i + 2];
+        const GLuint ab = midpoint(a, b), bc = midpoint(b, c), ca = midpoint(c, a);
+        // Same winding as the source triangle
+        addTriangle(result, a, ab, ca);
+        addTriangle(result, ab, b, bc);
+        addTriangle(result, ca, bc, c);
+        addTriangle(result, ab, bc, ca);
+    }
+    return result;
+}
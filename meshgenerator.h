@@ -0,0 +1,22 @@
+#ifndef MESHGENERATOR_H
+#define MESHGENERATOR_H
+
+#include "meshloader.h"
+
+// Procedural meshes at a chosen tessellation. All functions are reentrant, so levels of
+// detail can be built on the thread pool. Generated meshes fit the same unit box as the
+// hand-written ones.
+class MeshGenerator
+{
+public:
+    // UV sphere of radius 0.5 with segments around and segments / 2 rings
+    static MeshData sphere(int segments);
+    // Torus around the Y axis, segments around the ring and segments / 2 around the tube
+    static MeshData torus(int segments);
+    // Splits every triangle into four at its edge midpoints. All attributes are interpolated
+    // linearly, so the surface and its texturing stay exactly the same. Needs a mesh in CPU
+    // memory, a mapped one gives an invalid result
+    static MeshData subdivide(const MeshData &mesh);
+};
+
+#endif // MESHGENERATOR_H
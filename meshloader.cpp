@@ -0,0 +1,462 @@
+#include "meshloader.h"
+#include "meshcache.h"
+#include "meshoptimizer.h"
+#include "vertexformat.h"
+
+#include <QDir>
+#include <QFile>
+#include <QFileInfo>
+#include <QHash>
+#include <QJsonArray>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QUrl>
+#include <QVector2D>
+#include <QVector3D>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtEndian>
+#include <cstddef>
+#include <cstring>
+
+static Vertex makeVertex(const QVector3D &position, const QVector2D &texCoord)
+{
+    Vertex vertex;
+    vertex.position[0] = position.x();
+    vertex.position[1] = position.y();
+    vertex.position[2] = position.z();
+    vertex.color[0] = vertex.color[1] = vertex.color[2] = 1.0f;
+    vertex.texCoord[0] = texCoord.x();
+    vertex.texCoord[1] = texCoord.y();
+    vertex.material = 0.0f;
+    return vertex;
+}
+
+MeshData MeshLoader::fromInterleaved(const GLfloat *data, int vertexCount, int stride,
+                                     int colorOffset, int texOffset, int materialOffset,
+                                     const GLuint *indices, int indexCount)
+{
+    MeshData mesh;
+    mesh.vertices.resize(vertexCount);
+    for (int i = 0; i < vertexCount; i++) {
+        const GLfloat *src = data + i * stride;
+        Vertex &vertex = mesh.vertices[i];
+        vertex = makeVertex(QVector3D(src[0], src[1], src[2]),
+                            texOffset >= 0 ? QVector2D(src[texOffset], src[texOffset + 1]) : QVector2D());
+        if (colorOffset >= 0)
+            memcpy(vertex.color, src + colorOffset, 3 * sizeof(GLfloat));
+        if (materialOffset >= 0)
+            vertex.material = src[materialOffset];
+    }
+    mesh.indices.resize(indexCount);
+    memcpy(mesh.indices.data(), indices, indexCount * sizeof(GLuint));
+    return mesh;
+}
+
+MeshView MeshData::view() const
+{
+    if (mapped)
+        return mapped->view();
+    MeshView view;
+    view.vertices = vertices.constData();
+    view.vertexBytes = vertices.size() * qint64(sizeof(Vertex));
+    view.vertexStride = sizeof(Vertex);
+    view.attributes = {
+        { 0, 3, GL_FLOAT, GL_FALSE, GLuint(offsetof(Vertex, position)) },
+        { 1, 3, GL_FLOAT, GL_FALSE, GLuint(offsetof(Vertex, color)) },
+        { 2, 2, GL_FLOAT, GL_FALSE, GLuint(offsetof(Vertex, texCoord)) },
+        { 3, 1, GL_FLOAT, GL_FALSE, GLuint(offsetof(Vertex, material)) },
+    };
+    view.indices = indices.constData();
+    view.indexCount = indices.size();
+    view.indexType = GL_UNSIGNED_INT;
+    return view;
+}
+
+MeshData MeshLoader::load(const QString &path)
+{
+    QString suffix = QFileInfo(path).suffix().toLower();
+    if (suffix == "obj")
+        return loadObj(path);
+    if (suffix == "gltf" || suffix == "glb")
+        return loadGltf(path);
+    MeshData mesh;
+    mesh.error = QString("%1: unknown mesh format").arg(path);
+    return mesh;
+}
+
+MeshData MeshLoader::loadCached(const QString &path)
+{
+    MeshData mesh;
+    mesh.mapped = MeshCache::open(path);
+    if (mesh.mapped)
+        return mesh;
+
+    mesh = load(path);
+    if (mesh.isValid()) {
+        MeshOptimizer::optimize(mesh);
+        // Stored packed the way GeometryArena would pack it, so a hit uploads the mapping as is
+        const VertexFormat format = VertexFormat::choose(mesh.vertices);
+        const QByteArray vertices = format.pack(mesh.vertices);
+        const GLenum indexType = chooseIndexType(mesh.vertices.size());
+        const QByteArray indices = packIndices(mesh.indices.constData(), GL_UNSIGNED_INT, mesh.indices.size(), indexType);
+        MeshView packed;
+        packed.vertices = vertices.constData();
+        packed.vertexBytes = vertices.size();
+        packed.vertexStride = format.stride();
+        packed.attributes = format.attributes();
+        packed.indices = indices.constData();
+        packed.indexCount = mesh.indices.size();
+        packed.indexType = indexType;
+        QString error;
+        if (!MeshCache::write(MeshCache::cachePath(path), packed, QFileInfo(path), &error)) {
+            qWarning("Mesh cache: %s", qPrintable(error));
+            return mesh;
+        }
+        // The new entry is what gets uploaded, so a first load is copied no more than a hit
+        MeshData cached;
+        cached.mapped = MeshCache::open(path);
+        cached.optimization = mesh.optimization;
+        if (cached.mapped)
+            return cached;
+    }
+    return mesh;
+}
+
+QFuture<MeshData> MeshLoader::loadAsync(const QString &path)
+{
+    return QtConcurrent::run(&MeshLoader::loadCached, path);
+}
+
+// OBJ indices are 1-based, negative ones count back from the last element
+static int resolveObjIndex(int index, int count)
+{
+    if (index > 0 && index <= count)
+        return index - 1;
+    if (index < 0 && -index <= count)
+        return count + index;
+    return -1;
+}
+
+MeshData MeshLoader::loadObj(const QString &path)
+{
+    MeshData mesh;
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        mesh.error = QString("%1: %2").arg(path, file.errorString());
+        return mesh;
+    }
+
+    QVector<QVector3D> positions;
+    QVector<QVector2D> texCoords;
+    QHash<quint64, GLuint> vertexIds; // (position, texture coords) pair -> index in mesh.vertices
+    QVector<GLuint> face;
+    int lineNumber = 0;
+    while (!file.atEnd()) {
+        QByteArray line = file.readLine().simplified();
+        lineNumber++;
+        if (line.isEmpty() || line.startsWith('#'))
+            continue;
+        QList<QByteArray> tokens = line.split(' ');
+        const QByteArray &type = tokens[0];
+        if (type == "v" && tokens.size() >= 4) {
+            positions.append(QVector3D(tokens[1].toFloat(), tokens[2].toFloat(), tokens[3].toFloat()));
+        }
+        else if (type == "vt" && tokens.size() >= 3) {
+            texCoords.append(QVector2D(tokens[1].toFloat(), tokens[2].toFloat()));
+        }
+        else if (type == "f") {
+            face.clear();
+            for (int i = 1; i < tokens.size(); i++) {
+                // v, v/vt, v//vn or v/vt/vn; normals are not used
+                QList<QByteArray> refs = tokens[i].split('/');
+                bool hasTex = refs.size() > 1 && !refs[1].isEmpty();
+                int v = resolveObjIndex(refs[0].toInt(), positions.size());
+                int vt = hasTex ? resolveObjIndex(refs[1].toInt(), texCoords.size()) : -1;
+                if (v < 0 || (hasTex && vt < 0)) {
+                    mesh.error = QString("%1:%2: bad face index").arg(path).arg(lineNumber);
+                    return mesh;
+                }
+                quint64 key = (quint64(v) << 32) | quint32(vt + 1);
+                GLuint id = vertexIds.value(key, GLuint(-1));
+                if (id == GLuint(-1)) {
+                    id = mesh.vertices.size();
+                    mesh.vertices.append(makeVertex(positions[v], vt >= 0 ? texCoords[vt] : QVector2D()));
+                    vertexIds.insert(key, id);
+                }
+                face.append(id);
+            }
+            // Polygons are split into a triangle fan
+            for (int i = 2; i < face.size(); i++)
+                mesh.indices << face[0] << face[i - 1] << face[i];
+        }
+    }
+    if (mesh.indices.isEmpty())
+        mesh.error = QString("%1: no faces").arg(path);
+    return mesh;
+}
+
+namespace {
+
+struct GltfAsset
+{
+    QJsonObject json;
+    QVector<QByteArray> buffers;
+};
+
+enum GltfComponentType {
+    GltfByte = 5120,
+    GltfUnsignedByte = 5121,
+    GltfShort = 5122,
+    GltfUnsignedShort = 5123,
+    GltfUnsignedInt = 5125,
+    GltfFloat = 5126
+};
+
+}
+
+static bool readGltfAsset(const QString &path, GltfAsset &asset, QString &error)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly)) {
+        error = file.errorString();
+        return false;
+    }
+    QByteArray data = file.readAll();
+    QByteArray json;
+    QByteArray bin;
+    if (data.startsWith("glTF")) {
+        // GLB: 12 byte header, then chunks of (length, type, payload)
+        int offset = 12;
+        while (offset + 8 <= data.size()) {
+            const uchar *chunk = reinterpret_cast<const uchar *>(data.constData() + offset);
+            quint32 length = qFromLittleEndian<quint32>(chunk);
+            quint32 type = qFromLittleEndian<quint32>(chunk + 4);
+            if (qint64(offset) + 8 + length > data.size()) {
+                error = "truncated GLB chunk";
+                return false;
+            }
+            if (type == 0x4E4F534A) // "JSON"
+                json = data.mid(offset + 8, int(length));
+            else if (type == 0x004E4942) // "BIN\0"
+                bin = data.mid(offset + 8, int(length));
+            offset += 8 + int(length);
+        }
+    }
+    else {
+        json = data;
+    }
+
+    QJsonParseError parseError;
+    QJsonDocument document = QJsonDocument::fromJson(json, &parseError);
+    if (!document.isObject()) {
+        error = parseError.errorString();
+        return false;
+    }
+    asset.json = document.object();
+
+    QDir dir = QFileInfo(path).absoluteDir();
+    for (const QJsonValue &value : asset.json["buffers"].toArray()) {
+        QJsonObject buffer = value.toObject();
+        if (!buffer.contains("uri")) {
+            asset.buffers.append(bin); // buffer stored in the GLB BIN chunk
+            continue;
+        }
+        QString uri = buffer["uri"].toString();
+        if (uri.startsWith("data:")) {
+            asset.buffers.append(QByteArray::fromBase64(uri.mid(uri.indexOf(',') + 1).toLatin1()));
+            continue;
+        }
+        QFile external(dir.filePath(QUrl::fromPercentEncoding(uri.toUtf8())));
+        if (!external.open(QIODevice::ReadOnly)) {
+            error = QString("%1: %2").arg(external.fileName(), external.errorString());
+            return false;
+        }
+        asset.buffers.append(external.readAll());
+    }
+    return true;
+}
+
+static int gltfComponentCount(const QString &type)
+{
+    if (type == "SCALAR") return 1;
+    if (type == "VEC2") return 2;
+    if (type == "VEC3") return 3;
+    if (type == "VEC4") return 4;
+    return 0;
+}
+static int gltfComponentSize(int componentType)
+{
+    switch (componentType) {
+    case GltfByte:
+    case GltfUnsignedByte: return 1;
+    case GltfShort:
+    case GltfUnsignedShort: return 2;
+    case GltfUnsignedInt:
+    case GltfFloat: return 4;
+    }
+    return 0;
+}
+
+// Points data at the first element of an accessor, validating it lies inside its buffer
+static bool gltfAccessor(const GltfAsset &asset, int index, const char *&data, int &stride, int &count,
+                         int &components, int &componentType, bool &normalized, QString &error)
+{
+    QJsonArray accessors = asset.json["accessors"].toArray();
+    if (index < 0 || index >= accessors.size()) {
+        error = QString("accessor %1 doesn't exist").arg(index);
+        return false;
+    }
+    QJsonObject accessor = accessors[index].toObject();
+    components = gltfComponentCount(accessor["type"].toString());
+    componentType = accessor["componentType"].toInt();
+    normalized = accessor["normalized"].toBool();
+    count = accessor["count"].toInt();
+    int size = gltfComponentSize(componentType);
+    if (!components || !size || !accessor.contains("bufferView")) {
+        error = QString("accessor %1 isn't supported").arg(index);
+        return false;
+    }
+    QJsonArray views = asset.json["bufferViews"].toArray();
+    int viewIndex = accessor["bufferView"].toInt();
+    if (viewIndex < 0 || viewIndex >= views.size()) {
+        error = QString("accessor %1 refers to a missing buffer view").arg(index);
+        return false;
+    }
+    QJsonObject view = views[viewIndex].toObject();
+    int buffer = view["buffer"].toInt();
+    if (buffer < 0 || buffer >= asset.buffers.size()) {
+        error = QString("accessor %1 refers to a missing buffer").arg(index);
+        return false;
+    }
+    // Offsets are added as 64-bit, so neither they nor the stride can wrap around
+    const qint64 viewOffset = view["byteOffset"].toInt(), accessorOffset = accessor["byteOffset"].toInt();
+    const qint64 offset = viewOffset + accessorOffset;
+    stride = view.contains("byteStride") ? view["byteStride"].toInt() : components * size;
+    if (viewOffset < 0 || accessorOffset < 0 || stride < components * size) {
+        error = QString("accessor %1 has a bad offset or stride").arg(index);
+        return false;
+    }
+    const qint64 bufferSize = asset.buffers[buffer].size();
+    if (count < 0 || offset > bufferSize
+            || (count > 0 && offset + qint64(stride) * (count - 1) + components * size > bufferSize)) {
+        error = QString("accessor %1 is out of buffer bounds").arg(index);
+        return false;
+    }
+    data = asset.buffers[buffer].constData() + offset;
+    return true;
+}
+
+// glTF data is little-endian, as are all platforms we build for
+static float gltfComponent(const char *src, int componentType, bool normalized)
+{
+    switch (componentType) {
+    case GltfByte: { qint8 v; memcpy(&v, src, 1); return normalized ? qMax(v / 127.0f, -1.0f) : v; }
+    case GltfUnsignedByte: { quint8 v; memcpy(&v, src, 1); return normalized ? v / 255.0f : v; }
+    case GltfShort: { qint16 v; memcpy(&v, src, 2); return normalized ? qMax(v / 32767.0f, -1.0f) : v; }
+    case GltfUnsignedShort: { quint16 v; memcpy(&v, src, 2); return normalized ? v / 65535.0f : v; }
+    case GltfUnsignedInt: { quint32 v; memcpy(&v, src, 4); return float(v); }
+    case GltfFloat: { float v; memcpy(&v, src, 4); return v; }
+    }
+    return 0.0f;
+}
+
+// Reads wanted components of every element as floats, missing components are zero
+static bool gltfReadFloats(const GltfAsset &asset, int index, int wanted, QVector<float> &out, int &count, QString &error)
+{
+    const char *data;
+    int stride, components, componentType;
+    bool normalized;
+    if (!gltfAccessor(asset, index, data, stride, count, components, componentType, normalized, error))
+        return false;
+    int size = gltfComponentSize(componentType);
+    out.fill(0.0f, count * wanted);
+    for (int i = 0; i < count; i++)
+        for (int c = 0; c < qMin(components, wanted); c++)
+            out[i * wanted + c] = gltfComponent(data + i * stride + c * size, componentType, normalized);
+    return true;
+}
+
+static bool gltfReadIndices(const GltfAsset &asset, int index, GLuint base, QVector<GLuint> &out, QString &error)
+{
+    const char *data;
+    int stride, count, components, componentType;
+    bool normalized;
+    if (!gltfAccessor(asset, index, data, stride, count, components, componentType, normalized, error))
+        return false;
+    if (components != 1 || componentType == GltfFloat) {
+        error = QString("accessor %1 can't hold indices").arg(index);
+        return false;
+    }
+    out.reserve(out.size() + count);
+    for (int i = 0; i < count; i++)
+        out.append(base + GLuint(gltfComponent(data + i * stride, componentType, false)));
+    return true;
+}
+
+MeshData MeshLoader::loadGltf(const QString &path)
+{
+    MeshData mesh;
+    GltfAsset asset;
+    QString error;
+    if (!readGltfAsset(path, asset, error)) {
+        mesh.error = QString("%1: %2").arg(path, error);
+        return mesh;
+    }
+
+    // All triangle primitives of all meshes are merged, node transforms are not applied
+    for (const QJsonValue &meshValue : asset.json["meshes"].toArray()) {
+        for (const QJsonValue &primitiveValue : meshValue.toObject()["primitives"].toArray()) {
+            QJsonObject primitive = primitiveValue.toObject();
+            QJsonObject attributes = primitive["attributes"].toObject();
+            if (primitive.value("mode").toInt(4) != 4 || !attributes.contains("POSITION"))
+                continue;
+
+            QVector<float> positions, texCoords, colors;
+            int count, texCount = 0, colorCount = 0;
+            if (!gltfReadFloats(asset, attributes["POSITION"].toInt(), 3, positions, count, error)
+                    || (attributes.contains("TEXCOORD_0")
+                        && !gltfReadFloats(asset, attributes["TEXCOORD_0"].toInt(), 2, texCoords, texCount, error))
+                    || (attributes.contains("COLOR_0")
+                        && !gltfReadFloats(asset, attributes["COLOR_0"].toInt(), 3, colors, colorCount, error))) {
+                mesh.error = QString("%1: %2").arg(path, error);
+                return mesh;
+            }
+
+            GLuint base = mesh.vertices.size();
+            for (int i = 0; i < count; i++) {
+                // glTF puts the texture origin in the top left corner, GL in the bottom left
+                QVector2D texCoord = i < texCount ? QVector2D(texCoords[i * 2], 1.0f - texCoords[i * 2 + 1]) : QVector2D();
+                Vertex vertex = makeVertex(QVector3D(positions[i * 3], positions[i * 3 + 1], positions[i * 3 + 2]), texCoord);
+                if (i < colorCount)
+                    memcpy(vertex.color, colors.constData() + i * 3, 3 * sizeof(GLfloat));
+                mesh.vertices.append(vertex);
+            }
+
+            int firstIndex = mesh.indices.size();
+            if (primitive.contains("indices")) {
+                if (!gltfReadIndices(asset, primitive["indices"].toInt(), base, mesh.indices, error)) {
+                    mesh.error = QString("%1: %2").arg(path, error);
+                    return mesh;
+                }
+            }
+            else {
+                for (int i = 0; i < count; i++)
+                    mesh.indices.append(base + i);
+            }
+            // A partial triangle would shift every later one of the merged list
+            if ((mesh.indices.size() - firstIndex) % 3 != 0) {
+                mesh.error = QString("%1: primitive is not a triangle list").arg(path);
+                return mesh;
+            }
+            for (int i = firstIndex; i < mesh.indices.size(); i++) {
+                if (mesh.indices[i] >= GLuint(mesh.vertices.size())) {
+                    mesh.error = QString("%1: index out of range").arg(path);
+                    return mesh;
+                }
+            }
+        }
+    }
+    if (mesh.indices.isEmpty())
+        mesh.error = QString("%1: no triangle primitives").arg(path);
+    return mesh;
+}
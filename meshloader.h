@@ -0,0 +1,89 @@
+#ifndef MESHLOADER_H
+#define MESHLOADER_H
+
+#include <QFuture>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QSharedPointer>
+#include <QString>
+#include <QVector>
+
+class MappedMesh;
+
+// Interleaved vertex all meshes are converted to.
+// Attribute locations: 0 - position, 1 - color, 2 - texture coords, 3 - material slot
+struct Vertex
+{
+    GLfloat position[3];
+    GLfloat color[3];
+    GLfloat texCoord[2];
+    GLfloat material; // index into the material table of the mesh type
+};
+
+// One vertex attribute as passed to glVertexAttribPointer, offset in bytes
+struct VertexAttribute
+{
+    GLuint location;
+    GLint components;
+    GLenum type;
+    GLboolean normalized;
+    GLuint offset;
+};
+
+// Non-owning view of GPU-ready geometry, this is what gets uploaded
+struct MeshView
+{
+    const void *vertices;
+    qint64 vertexBytes;
+    GLsizei vertexStride;
+    QVector<VertexAttribute> attributes;
+    const void *indices;
+    GLsizei indexCount;
+    GLenum indexType;
+};
+
+// What MeshOptimizer did to a mesh. ACMR is vertex shader runs per triangle,
+// all zero - the mesh wasn't optimized or was mapped from the mesh cache
+struct MeshOptimizeStats
+{
+    int verticesBefore;
+    int verticesAfter;
+    double acmrBefore;
+    double acmrAfter;
+
+    MeshOptimizeStats() : verticesBefore(0), verticesAfter(0), acmrBefore(0.0), acmrAfter(0.0) {}
+};
+
+// Indexed triangle list, either in CPU memory or mapped from the binary mesh cache
+struct MeshData
+{
+    QVector<Vertex> vertices;
+    QVector<GLuint> indices;
+    QSharedPointer<MappedMesh> mapped; // set instead of vertices/indices on a cache hit
+    QString error; // why loading failed, empty on success
+    MeshOptimizeStats optimization;
+
+    bool isValid() const { return error.isEmpty() && (!indices.isEmpty() || mapped); }
+    MeshView view() const;
+};
+
+// Parses OBJ and glTF (.gltf/.glb) files into MeshData. All functions are reentrant,
+// loadAsync runs on the global thread pool. loadCached and loadAsync go through the
+// binary mesh cache: a hit maps the cached file, a miss parses the source, runs MeshOptimizer
+// on it and fills the cache with it packed to its VertexFormat, then maps the new entry.
+// Either way the upload reads the mapping without intermediate copies.
+class MeshLoader
+{
+public:
+    // Repacks a hand-written interleaved float array, offsets are in floats, -1 - attribute is absent
+    static MeshData fromInterleaved(const GLfloat *data, int vertexCount, int stride,
+                                    int colorOffset, int texOffset, int materialOffset,
+                                    const GLuint *indices, int indexCount);
+
+    static MeshData load(const QString &path);
+    static MeshData loadCached(const QString &path);
+    static MeshData loadObj(const QString &path);
+    static MeshData loadGltf(const QString &path);
+    static QFuture<MeshData> loadAsync(const QString &path);
+};
+
+#endif // MESHLOADER_H
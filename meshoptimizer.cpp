@@ -0,0 +1,319 @@
+#include "meshoptimizer.h"
+
+#include <QHash>
+#include <QVector3D>
+#include <QtMath>
+#include <algorithm>
+#include <cstring>
+
+namespace {
+
+// Forsyth's tuning; the cache modelled while ordering is larger than the one acmr() checks,
+// which costs little on small caches and helps on large ones
+const int CacheSize = 32;
+const float CacheDecayPower = 1.5f;
+const float LastTriangleScore = 0.75f;
+const float ValenceBoostScale = 2.0f;
+const float ValenceBoostPower = 0.5f;
+
+// cachePosition -1 - not in the cache; remaining - triangles still to emit that use the vertex
+float vertexScore(int cachePosition, int remaining)
+{
+    if (remaining == 0)
+        return -1.0f;
+    float score = 0.0f;
+    if (cachePosition >= 0) {
+        // The last triangle's vertices get a fixed score, or it would simply be drawn again
+        if (cachePosition < 3)
+            score = LastTriangleScore;
+        else
+            score = qPow(1.0f - float(cachePosition - 3) / (CacheSize - 3), CacheDecayPower);
+    }
+    // Vertices with few triangles left are worth finishing so they can leave the cache
+    return score + ValenceBoostScale * qPow(float(remaining), -ValenceBoostPower);
+}
+
+// Vertex compared and hashed by its bytes
+struct VertexKey
+{
+    const Vertex *vertex;
+
+    bool operator==(const VertexKey &other) const
+    {
+        return memcmp(vertex, other.vertex, sizeof(Vertex)) == 0;
+    }
+};
+
+uint qHash(const VertexKey &key, uint seed)
+{
+    return qHashBits(key.vertex, sizeof(Vertex), seed);
+}
+
+QVector3D positionOf(const Vertex &vertex)
+{
+    return QVector3D(vertex.position[0], vertex.position[1], vertex.position[2]);
+}
+
+} // namespace
+
+void MeshOptimizer::optimize(MeshData &mesh)
+{
+    if (mesh.mapped || mesh.indices.isEmpty())
+        return;
+    MeshOptimizeStats &stats = mesh.optimization;
+    stats.verticesBefore = mesh.vertices.size();
+    stats.acmrBefore = acmr(mesh.indices, mesh.vertices.size());
+
+    weld(mesh);
+    optimizeVertexCache(mesh.indices, mesh.vertices.size());
+    optimizeOverdraw(mesh.vertices, mesh.indices);
+    optimizeFetch(mesh);
+
+    stats.verticesAfter = mesh.vertices.size();
+    stats.acmrAfter = acmr(mesh.indices, mesh.vertices.size());
+}
+
+void MeshOptimizer::weld(MeshData &mesh)
+{
+    const int count = mesh.vertices.size();
+    QHash<VertexKey, GLuint> unique;
+    unique.reserve(count);
+    QVector<GLuint> remap(count);
+    QVector<Vertex> welded;
+    welded.reserve(count);
+    for (int i = 0; i < count; i++) {
+        const VertexKey key = { &mesh.vertices.at(i) };
+        auto found = unique.constFind(key);
+        if (found != unique.constEnd()) {
+            remap[i] = found.value();
+            continue;
+        }
+        remap[i] = GLuint(welded.size());
+        unique.insert(key, remap[i]);
+        welded.append(mesh.vertices.at(i));
+    }
+    if (welded.size() == count)
+        return;
+    for (GLuint &index : mesh.indices)
+        index = remap[index];
+    mesh.vertices = welded;
+}
+
+void MeshOptimizer::optimizeVertexCache(QVector<GLuint> &indices, int vertexCount)
+{
+    const int triangleCount = indices.size() / 3;
+    if (triangleCount < 2)
+        return;
+
+    // Triangles using each vertex, vertex v owns adjacency[offsets[v] .. offsets[v] + remaining[v]).
+    // Emitted triangles are swapped out of the live part of the range
+    QVector<int> offsets(vertexCount + 1, 0);
+    for (GLuint index : indices)
+        offsets[int(index) + 1]++;
+    QVector<int> remaining(vertexCount);
+    for (int v = 0; v < vertexCount; v++) {
+        remaining[v] = offsets[v + 1];
+        offsets[v + 1] += offsets[v];
+    }
+    QVector<int> adjacency(indices.size());
+    {
+        QVector<int> fill = offsets;
+        for (int t = 0; t < triangleCount; t++) {
+            for (int corner = 0; corner < 3; corner++)
+                adjacency[fill[int(indices[3 * t + corner])]++] = t;
+        }
+    }
+
+    QVector<int> cachePositions(vertexCount, -1);
+    QVector<float> vertexScores(vertexCount);
+    for (int v = 0; v < vertexCount; v++)
+        vertexScores[v] = vertexScore(-1, remaining[v]);
+    QVector<bool> emitted(triangleCount, false);
+    int best = -1;
+    float bestScore = -1.0f;
+    for (int t = 0; t < triangleCount; t++) {
+        const GLuint *triangle = indices.constData() + 3 * t;
+        const float score = vertexScores[triangle[0]] + vertexScores[triangle[1]] + vertexScores[triangle[2]];
+        if (score > bestScore) {
+            bestScore = score;
+            best = t;
+        }
+    }
+
+    QVector<GLuint> ordered;
+    ordered.reserve(indices.size());
+    int cache[CacheSize + 3];
+    int cached = 0;
+    int scan = 0; // no triangle before it is left, for restarts
+    for (int done = 0; done < triangleCount; done++) {
+        if (best < 0) {
+            // Nothing in the cache has triangles left, carry on anywhere
+            while (emitted[scan])
+                scan++;
+            best = scan;
+        }
+        const GLuint *triangle = indices.constData() + 3 * best;
+        emitted[best] = true;
+        for (int corner = 0; corner < 3; corner++) {
+            const int v = int(triangle[corner]);
+            ordered.append(GLuint(v));
+            int *live = adjacency.data() + offsets[v];
+            for (int i = 0; i < remaining[v]; i++) {
+                if (live[i] == best) {
+                    live[i] = live[--remaining[v]];
+                    break;
+                }
+            }
+        }
+
+        // Most recent first: the triangle's vertices, then the old cache without them
+        int updated[CacheSize + 3];
+        int count = 0;
+        for (int corner = 0; corner < 3; corner++) {
+            const int v = int(triangle[corner]);
+            if (std::find(updated, updated + count, v) == updated + count)
+                updated[count++] = v;
+        }
+        for (int i = 0; i < cached; i++) {
+            if (std::find(updated, updated + count, cache[i]) == updated + count)
+                updated[count++] = cache[i];
+        }
+        // Those pushed past the end are evicted but still rescored
+        for (int i = 0; i < count; i++) {
+            const int v = updated[i];
+            cachePositions[v] = i < CacheSize ? i : -1;
+            vertexScores[v] = vertexScore(cachePositions[v], remaining[v]);
+        }
+        // Only triangles of cached vertices changed score, the best is among them
+        best = -1;
+        bestScore = -1.0f;
+        for (int i = 0; i < count; i++) {
+            const int v = updated[i];
+            const int *live = adjacency.constData() + offsets[v];
+            for (int j = 0; j < remaining[v]; j++) {
+                const GLuint *other = indices.constData() + 3 * live[j];
+                const float score = vertexScores[other[0]] + vertexScores[other[1]] + vertexScores[other[2]];
+                if (score > bestScore) {
+                    bestScore = score;
+                    best = live[j];
+                }
+            }
+        }
+        cached = qMin(count, CacheSize);
+        std::copy(updated, updated + cached, cache);
+    }
+    indices = ordered;
+}
+
+void MeshOptimizer::optimizeOverdraw(const QVector<Vertex> &vertices, QVector<GLuint> &indices, float threshold)
+{
+    const int triangleCount = indices.size() / 3;
+    if (triangleCount < 2)
+        return;
+
+    // A cluster starts at each triangle where the cache order jumped: all three vertices miss
+    QVector<int> starts;
+    starts.append(0);
+    {
+        QVector<int> stamps(vertices.size(), 0);
+        int next = AnalyzeCacheSize + 1;
+        for (int t = 0; t < triangleCount; t++) {
+            int misses = 0;
+            for (int corner = 0; corner < 3; corner++) {
+                int &stamp = stamps[int(indices[3 * t + corner])];
+                if (next - stamp > AnalyzeCacheSize) {
+                    stamp = next++;
+                    misses++;
+                }
+            }
+            if (misses == 3 && t > 0)
+                starts.append(t);
+        }
+    }
+    if (starts.size() < 2)
+        return;
+    starts.append(triangleCount);
+
+    // Area weighted centroids; an unnormalized cross product is the normal times twice the area
+    struct Cluster
+    {
+        int first;
+        int count;
+        QVector3D centroid;
+        QVector3D normal;
+        float key;
+    };
+    QVector<Cluster> clusters;
+    clusters.reserve(starts.size() - 1);
+    QVector3D meshCentroid;
+    float meshArea = 0.0f;
+    for (int i = 0; i + 1 < starts.size(); i++) {
+        Cluster cluster;
+        cluster.first = starts[i];
+        cluster.count = starts[i + 1] - starts[i];
+        float area = 0.0f;
+        for (int t = cluster.first; t < starts[i + 1]; t++) {
+            const QVector3D a = positionOf(vertices.at(int(indices[3 * t])));
+            const QVector3D b = positionOf(vertices.at(int(indices[3 * t + 1])));
+            const QVector3D c = positionOf(vertices.at(int(indices[3 * t + 2])));
+            const QVector3D normal = QVector3D::crossProduct(b - a, c - a);
+            const float triangleArea = normal.length() * 0.5f;
+            cluster.normal += normal;
+            cluster.centroid += (a + b + c) * (triangleArea / 3.0f);
+            area += triangleArea;
+        }
+        meshCentroid += cluster.centroid;
+        meshArea += area;
+        if (area > 0.0f)
+            cluster.centroid /= area;
+        clusters.append(cluster);
+    }
+    if (meshArea > 0.0f)
+        meshCentroid /= meshArea;
+    for (Cluster &cluster : clusters)
+        cluster.key = QVector3D::dotProduct(cluster.centroid - meshCentroid, cluster.normal.normalized());
+    std::stable_sort(clusters.begin(), clusters.end(), [](const Cluster &a, const Cluster &b) {
+        return a.key > b.key;
+    });
+
+    QVector<GLuint> sorted;
+    sorted.reserve(indices.size());
+    for (const Cluster &cluster : clusters)
+        sorted.append(indices.mid(3 * cluster.first, 3 * cluster.count));
+    if (acmr(sorted, vertices.size()) <= acmr(indices, vertices.size()) * threshold)
+        indices = sorted;
+}
+
+void MeshOptimizer::optimizeFetch(MeshData &mesh)
+{
+    const GLuint unused = ~0u;
+    QVector<GLuint> remap(mesh.vertices.size(), unused);
+    QVector<Vertex> ordered;
+    ordered.reserve(mesh.vertices.size());
+    for (GLuint &index : mesh.indices) {
+        if (remap[int(index)] == unused) {
+            remap[int(index)] = GLuint(ordered.size());
+            ordered.append(mesh.vertices.at(int(index)));
+        }
+        index = remap[int(index)];
+    }
+    mesh.vertices = ordered;
+}
+
+double MeshOptimizer::acmr(const QVector<GLuint> &indices, int vertexCount, int cacheSize)
+{
+    if (indices.size() < 3)
+        return 0.0;
+    // A vertex is cached while fewer than cacheSize others went in after it
+    QVector<int> stamps(vertexCount, 0);
+    int next = cacheSize + 1;
+    int misses = 0;
+    for (GLuint index : indices) {
+        int &stamp = stamps[int(index)];
+        if (next - stamp > cacheSize) {
+            stamp = next++;
+            misses++;
+        }
+    }
+    return double(misses) / (indices.size() / 3);
+}
@@ -0,0 +1,35 @@
+#ifndef MESHOPTIMIZER_H
+#define MESHOPTIMIZER_H
+
+#include "meshloader.h"
+
+// Reorders an indexed triangle list for the GPU without changing what it draws. optimize()
+// runs all passes in order; they are public so a pass can be measured on its own. All
+// functions are reentrant and work on meshes in CPU memory, mapped ones are left alone.
+class MeshOptimizer
+{
+public:
+    // Cache size acmr() models by default, a conservative guess for current hardware
+    enum { AnalyzeCacheSize = 16 };
+
+    // weld, optimizeVertexCache, optimizeOverdraw, optimizeFetch; fills mesh.optimization
+    static void optimize(MeshData &mesh);
+
+    // Merges vertices whose attributes are bitwise equal
+    static void weld(MeshData &mesh);
+    // Forsyth's linear-speed vertex cache optimization: greedily emits the triangle whose
+    // vertices score highest on recent use and on how few triangles still need them
+    static void optimizeVertexCache(QVector<GLuint> &indices, int vertexCount);
+    // Splits the cache order into clusters where it restarts and draws the clusters facing
+    // away from the mesh center first, which on convex-ish meshes puts outer surfaces before
+    // what they hide. Kept only if ACMR grows by at most threshold times
+    static void optimizeOverdraw(const QVector<Vertex> &vertices, QVector<GLuint> &indices,
+                                 float threshold = 1.05f);
+    // Renumbers vertices in order of first use and drops unused ones
+    static void optimizeFetch(MeshData &mesh);
+
+    // Average cache miss ratio: vertex shader runs per triangle on a FIFO cache
+    static double acmr(const QVector<GLuint> &indices, int vertexCount, int cacheSize = AnalyzeCacheSize);
+};
+
+#endif // MESHOPTIMIZER_H
@@ -0,0 +1,146 @@
+#include "programcache.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QFileInfo>
+#include <QOpenGLContext>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <cstring>
+
+#ifndef GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+#define GL_PROGRAM_BINARY_RETRIEVABLE_HINT 0x8257
+#endif
+#ifndef GL_PROGRAM_BINARY_LENGTH
+#define GL_PROGRAM_BINARY_LENGTH 0x8741
+#endif
+#ifndef GL_NUM_PROGRAM_BINARY_FORMATS
+#define GL_NUM_PROGRAM_BINARY_FORMATS 0x87FE
+#endif
+
+namespace {
+
+const char programMagic[8] = { 'L', 'W', '2', 'P', 'R', 'O', 'G', '\0' };
+
+struct ProgramFileHeader
+{
+    char magic[8];
+    quint32 format; // as returned by glGetProgramBinary
+    quint32 length;
+};
+
+}
+
+ProgramCache::ProgramCache()
+{
+    m_supported = false;
+    m_stats.hits = 0;
+    m_stats.misses = 0;
+    m_stats.loadMs = 0.0;
+    m_stats.compileMs = 0.0;
+}
+
+void ProgramCache::initialize()
+{
+    initializeOpenGLFunctions();
+    QOpenGLContext *context = QOpenGLContext::currentContext();
+    m_supported = context->format().version() >= qMakePair(4, 1)
+            || context->hasExtension(QByteArrayLiteral("GL_ARB_get_program_binary"));
+    if (m_supported) {
+        // Some drivers expose the entry points but no binary format at all
+        GLint formats = 0;
+        glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+        m_supported = formats > 0;
+    }
+    m_driver = QByteArray(reinterpret_cast<const char *>(glGetString(GL_VENDOR))) + '\n'
+            + reinterpret_cast<const char *>(glGetString(GL_RENDERER)) + '\n'
+            + reinterpret_cast<const char *>(glGetString(GL_VERSION));
+}
+
+QString ProgramCache::cachePath(const char *vertexSource, const char *fragmentSource)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(vertexSource, int(strlen(vertexSource)) + 1);
+    hash.addData(fragmentSource, int(strlen(fragmentSource)) + 1);
+    hash.addData(m_driver);
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+            + "/programs/" + QString::fromLatin1(hash.result().toHex()) + ".lw2prog";
+}
+
+bool ProgramCache::build(QOpenGLShaderProgram &program, const char *vertexSource, const char *fragmentSource)
+{
+    QElapsedTimer timer;
+    timer.start();
+    QString path;
+    if (m_supported) {
+        path = cachePath(vertexSource, fragmentSource);
+        if (loadBinary(program, path)) {
+            m_stats.hits++;
+            m_stats.loadMs += timer.nsecsElapsed() / 1.0e6;
+            return true;
+        }
+    }
+
+    program.addShaderFromSourceCode(QOpenGLShader::Vertex, vertexSource);
+    program.addShaderFromSourceCode(QOpenGLShader::Fragment, fragmentSource);
+    if (m_supported)
+        glProgramParameteri(program.programId(), GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+    bool linked = program.link();
+    if (linked && m_supported)
+        saveBinary(program, path);
+    m_stats.misses++;
+    m_stats.compileMs += timer.nsecsElapsed() / 1.0e6;
+    return linked;
+}
+
+bool ProgramCache::loadBinary(QOpenGLShaderProgram &program, const QString &path)
+{
+    QFile file(path);
+    if (!file.open(QIODevice::ReadOnly))
+        return false;
+    QByteArray data = file.readAll();
+    ProgramFileHeader header;
+    if (quint64(data.size()) < sizeof(header))
+        return false;
+    memcpy(&header, data.constData(), sizeof(header));
+    if (memcmp(header.magic, programMagic, sizeof(programMagic)) != 0
+            || header.length != quint64(data.size()) - sizeof(header))
+        return false;
+
+    program.create();
+    glProgramBinary(program.programId(), header.format, data.constData() + sizeof(header), GLsizei(header.length));
+    // Drivers reject binaries after an update even when the version string stays the same
+    GLint status = GL_FALSE;
+    glGetProgramiv(program.programId(), GL_LINK_STATUS, &status);
+    if (status != GL_TRUE)
+        return false;
+    // Without attached shaders link() only picks up the link status of the binary
+    return program.link();
+}
+
+void ProgramCache::saveBinary(QOpenGLShaderProgram &program, const QString &path)
+{
+    GLint length = 0;
+    glGetProgramiv(program.programId(), GL_PROGRAM_BINARY_LENGTH, &length);
+    if (length <= 0)
+        return;
+    QByteArray data(int(sizeof(ProgramFileHeader)) + length, '\0');
+    GLenum format = 0;
+    GLsizei written = 0;
+    glGetProgramBinary(program.programId(), length, &written, &format, data.data() + sizeof(ProgramFileHeader));
+    if (written <= 0)
+        return;
+    data.resize(int(sizeof(ProgramFileHeader)) + written);
+    ProgramFileHeader header;
+    memcpy(header.magic, programMagic, sizeof(programMagic));
+    header.format = format;
+    header.length = quint32(written);
+    memcpy(data.data(), &header, sizeof(header));
+
+    QDir().mkpath(QFileInfo(path).absolutePath());
+    QSaveFile file(path);
+    if (!file.open(QIODevice::WriteOnly) || file.write(data) != data.size() || !file.commit())
+        qWarning("Program cache: %s: %s", qPrintable(path), qPrintable(file.errorString()));
+}
@@ -0,0 +1,41 @@
+#ifndef PROGRAMCACHE_H
+#define PROGRAMCACHE_H
+
+#include <QOpenGLExtraFunctions>
+#include <QOpenGLShaderProgram>
+
+// Keeps linked program binaries (glGetProgramBinary) in the user cache directory, keyed by
+// the shader sources and the GL vendor, renderer and version strings. A binary the driver
+// rejects is silently replaced by a fresh compile. Without GL_ARB_get_program_binary
+// every program is simply compiled from source.
+class ProgramCache : protected QOpenGLExtraFunctions
+{
+public:
+    // Totals since initialize(); times are wall clock of the whole build() call
+    struct Stats {
+        int hits;
+        int misses;
+        double loadMs;    // spent on hits
+        double compileMs; // spent on misses, including rejected binaries
+    };
+
+    ProgramCache();
+
+    // These need a current GL context
+    void initialize();
+    bool build(QOpenGLShaderProgram &program, const char *vertexSource, const char *fragmentSource);
+
+    bool supported() const { return m_supported; }
+    const Stats &stats() const { return m_stats; }
+
+private:
+    QString cachePath(const char *vertexSource, const char *fragmentSource);
+    bool loadBinary(QOpenGLShaderProgram &program, const QString &path);
+    void saveBinary(QOpenGLShaderProgram &program, const QString &path);
+
+    bool m_supported;
+    QByteArray m_driver; // vendor, renderer and version, part of every key
+    Stats m_stats;
+};
+
+#endif // PROGRAMCACHE_H
@@ -0,0 +1,984 @@
+#include "renderer.h"
+#include "meshgenerator.h"
+#include "meshoptimizer.h"
+#include "transformkernel.h"
+
+#include <QtConcurrent/QtConcurrentMap>
+#include <QtConcurrent/QtConcurrentRun>
+#include <QtMath>
+#include <cstddef>
+
+// One program for every mesh type. The per-vertex material slot picks a layer of the
+// texture array through the layers table of the mesh type, so there is no branching per fragment.
+static const char *vertexShaderSource =
+    "#version 330 core\n"
+    "layout (location = 0) in vec3 aPos;\n"
+    "layout (location = 1) in vec3 aCol;\n"
+    "layout (location = 2) in vec2 aTex;\n"
+    "layout (location = 3) in float aMaterial;\n"
+    "out vec3 ourColor;\n"
+    "out vec2 TexCoord;\n"
+    "flat out float TexLayer;\n"
+    "layout (location = 4) in mat4 aModel;\n"
+    "layout (std140) uniform Camera\n"
+    "{\n"
+    "    mat4 view;\n"
+    "    mat4 projection;\n"
+    "    mat4 viewProjection;\n"
+    "    vec4 cameraPos;\n"
+    "};\n"
+    "uniform mat4 model;\n"
+    "uniform bool instanced;\n"
+    "uniform int layers[2];\n"
+    "void main()\n"
+    "{\n"
+    "    mat4 m = instanced ? aModel : model;\n"
+    "    gl_Position = viewProjection * m * vec4(aPos, 1.0);\n"
+    "    ourColor = aCol;\n"
+    "    TexCoord = aTex;\n"
+    "    TexLayer = float(layers[clamp(int(aMaterial + 0.5), 0, 1)]);\n"
+    "}\n\0";
+
+static const char *fragmentShaderSource =
+    "#version 330 core\n"
+    "in vec3 ourColor;\n"
+    "in vec2 TexCoord;\n"
+    "flat in float TexLayer;\n"
+    "out vec4 FragColor;\n"
+    "uniform sampler2DArray mTextures;\n"
+    "uniform float colorMix;\n"
+    "void main()\n"
+    "{\n"
+    "    FragColor = mix(texture(mTextures, vec3(TexCoord, TexLayer)), vec4(ourColor, 1.0), colorMix);\n"
+    "}\n\0";
+
+// Objects the scene starts with
+static const struct {
+    Renderer::MeshKind kind;
+    QVector3D position;
+} initialObjects[] = {
+    { Renderer::Container, QVector3D( 0.0f,  0.0f,  0.0f) },
+    { Renderer::Container, QVector3D( 0.0f,  5.0f, -10.0f) },
+    { Renderer::Container, QVector3D( 2.4f, -1.2f, -3.5f) },
+    { Renderer::Container, QVector3D(-3.8f, -2.0f, -10.3f) },
+    { Renderer::Pyramid4,  QVector3D( 1.5f,  0.2f, -1.5f) },
+    { Renderer::Pyramid4,  QVector3D(-1.3f,  1.0f, -1.5f) },
+    { Renderer::Tower,     QVector3D( 1.3f, -2.0f, -2.5f) },
+    { Renderer::Tower,     QVector3D( 1.5f,  2.0f, -2.5f) },
+    { Renderer::Pyramid3,  QVector3D(-1.5f, -2.2f, -2.5f) },
+    { Renderer::Pyramid3,  QVector3D(-1.7f,  2.0f, -1.5f) },
+    { Renderer::Sphere,    QVector3D(-2.6f,  0.4f, -4.0f) },
+    { Renderer::Torus,     QVector3D( 2.9f,  0.8f, -5.0f) },
+};
+
+static const float FieldOfView = 45.0f;
+static const float NearPlane = 0.1f;
+static const float FarPlane = 100.0f;
+
+// Screen radius in pixels an object must reach to use level N; each level is a quarter of
+// the triangles of the one above. A level is only left once the size is LodHysteresis past
+// its threshold, so objects resting near one don't switch every frame
+static const float LodThresholds[Renderer::MaxLodLevels - 1] = { 160.0f, 64.0f, 24.0f };
+static const float LodHysteresis = 0.2f;
+static const float MaxLodBias = 64.0f;
+static const int DefaultTriangleBudget = 1000000;
+// Segments of the coarsest sphere and torus, doubled per finer level
+static const int CoarseSegments = 8;
+
+static const char *const meshNames[] = { "containers", "pyramid4", "pyramid3", "towers", "spheres", "tori" };
+
+// Levels above the coarsest one, finest first. Runs on the thread pool
+static QVector<MeshData> finerLevels(Renderer::MeshKind kind, MeshData coarsest, int count)
+{
+    QVector<MeshData> levels;
+    for (int step = 1; step <= count; step++) {
+        if (kind == Renderer::Sphere)
+            coarsest = MeshGenerator::sphere(CoarseSegments << step);
+        else if (kind == Renderer::Torus)
+            coarsest = MeshGenerator::torus(CoarseSegments << step);
+        else
+            coarsest = MeshGenerator::subdivide(coarsest);
+        levels.prepend(coarsest);
+        MeshOptimizer::optimize(levels.first());
+    }
+    return levels;
+}
+
+Renderer::Renderer()
+{
+    m_initialized = false;
+    m_instanced = false;
+    m_occlusion = false;
+    m_occluder = -1;
+    m_frame = 0;
+    for (int material = 0; material < MaterialCount; material++)
+        setMaterial(material, 0, 0, 0.0f);
+    for (int kind = 0; kind < MeshKindCount; kind++) {
+        m_meshes[kind].count = 0;
+        m_lod_pending[kind] = false;
+    }
+    m_triangle_budget = DefaultTriangleBudget;
+    m_lod_bias = 1.0f;
+    m_lod_stats.triangles = 0;
+    m_lod_stats.bias = 1.0f;
+    for (int &objects : m_lod_stats.objects)
+        objects = 0;
+    m_camera_ubo = 0;
+    m_bound_material = -1;
+    m_bvh_dirty = true;
+    m_bvh_version = 0;
+    m_cull_stats.objects = m_cull_stats.visible = m_cull_stats.occluded = 0;
+    m_cull_stats.cpuMs = 0.0;
+    m_cull_stats.queueMs = 0.0;
+    for (GroupStats &stats : m_stats) {
+        stats.gpuMs = -1.0;
+        stats.cpuMs = 0.0;
+        stats.drawCalls = 0;
+        stats.triangles = 0;
+    }
+    for (const auto &object : initialObjects)
+        addObject(object.kind, object.position);
+}
+Renderer::~Renderer()
+{}
+
+void Renderer::setInstanced(bool enabled)
+{
+    m_instanced = enabled;
+}
+void Renderer::setOcclusionCulling(bool enabled)
+{
+    m_occlusion = enabled;
+}
+void Renderer::setTriangleBudget(int triangles)
+{
+    m_triangle_budget = qMax(triangles, 0);
+}
+bool Renderer::loading() const
+{
+    for (bool pending : m_lod_pending) {
+        if (pending)
+            return true;
+    }
+    return m_textures.busy();
+}
+void Renderer::finishLoading()
+{
+    m_textures.finish();
+    for (int kind = 0; kind < MeshKindCount; kind++) {
+        if (m_lod_pending[kind])
+            m_lod_jobs[kind].waitForFinished();
+    }
+    updateLods();
+}
+int Renderer::addObject(MeshKind kind, const QVector3D &position, const QQuaternion &rotation,
+                        const QVector3D &scale, int material)
+{
+    if (material < 0 || material >= MaterialCount)
+        material = kind;
+    return m_objects.add(kind, material, position, rotation, scale);
+}
+void Renderer::removeObject(int handle)
+{
+    if (!m_objects.contains(handle))
+        return;
+    // EntityStore moves the last object into the hole, its LOD state has to follow it
+    const int slot = m_objects.slot(handle);
+    const int last = m_objects.size() - 1;
+    if (last < m_lod_levels.size()) {
+        m_lod_levels[slot] = m_lod_levels[last];
+        m_lod_levels.resize(last);
+    }
+    else if (slot < m_lod_levels.size()) {
+        // The moved object hasn't been drawn yet, it starts at the coarsest level like any new one
+        m_lod_levels[slot] = quint8(MaxLodLevels - 1);
+    }
+    m_objects.remove(handle);
+}
+void Renderer::clearObjects()
+{
+    m_objects.clear();
+    m_lod_levels.clear();
+}
+const char *Renderer::meshName(MeshKind kind)
+{
+    return meshNames[kind];
+}
+bool Renderer::meshKindFromName(const QString &name, MeshKind &kind)
+{
+    for (int i = 0; i < MeshKindCount; i++) {
+        if (name == meshNames[i]) {
+            kind = MeshKind(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+void Renderer::initialize()
+{
+    initializeOpenGLFunctions();
+
+    glClearColor(0, 0, 0, 1);
+    glEnable(GL_DEPTH_TEST);
+
+    // Create VAO & VBO, bind it to current GL_ARRAY_BUFFER and load vertices into it
+    GLfloat vertices_pyramid4[] = {
+        // positions         // texture coords & material (1 - cube, 0 - triangle)
+        0.5f, -0.5f, 0.5f,   1.0f, 1.0f,    1.0f,   // top right
+        0.5f, -0.5f,-0.5f,   1.0f, 0.0f,    1.0f,   // bottom right
+       -0.5f, -0.5f,-0.5f,   0.0f, 0.0f,    1.0f,   // bottom left
+       -0.5f, -0.5f, 0.5f,   0.0f, 1.0f,    1.0f,   // top left
+
+        0.5f, -0.5f, 0.5f,   0.0f, 0.0f,    0.0f,   //1-2
+        0.5f, -0.5f,-0.5f,   1.0f, 0.0f,    0.0f,
+        0.0f,  0.5f, 0.0f,   0.5f, 1.0f,    0.0f,
+
+        0.5f, -0.5f,-0.5f,   0.0f, 0.0f,    0.0f,   //2-3
+       -0.5f, -0.5f,-0.5f,   1.0f, 0.0f,    0.0f,
+        0.0f,  0.5f, 0.0f,   0.5f, 1.0f,    0.0f,
+
+       -0.5f, -0.5f,-0.5f,   0.0f, 0.0f,    0.0f,   //3-4
+       -0.5f, -0.5f, 0.5f,   1.0f, 0.0f,    0.0f,
+        0.0f,  0.5f, 0.0f,   0.5f, 1.0f,    0.0f,
+
+       -0.5f, -0.5f, 0.5f,   0.0f, 0.0f,    0.0f,   //4-1
+        0.5f, -0.5f, 0.5f,   1.0f, 0.0f,    0.0f,
+        0.0f,  0.5f, 0.0f,   0.5f, 1.0f,    0.0f,
+    };
+    GLuint indices_pyramid4[] = {
+        0, 1, 2,
+        0, 2, 3,
+
+        4, 5, 6,
+        7, 8, 9,
+        10, 11, 12,
+        13, 14, 15,
+    };
+
+    GLfloat vertices_container[] = {
+        // positions          // colors           // texture coords
+        0.5f,  0.5f, 0.5f,   1.0f, 0.0f, 0.0f,   1.0f, 1.0f,   // top right
+        0.5f, -0.5f, 0.5f,   0.0f, 1.0f, 0.0f,   1.0f, 0.0f,   // bottom right
+       -0.5f, -0.5f, 0.5f,   0.0f, 0.0f, 1.0f,   0.0f, 0.0f,   // bottom left
+       -0.5f,  0.5f, 0.5f,   1.0f, 1.0f, 0.0f,   0.0f, 1.0f,   // top left
+
+        0.5f, -0.5f, 0.5f,   0.0f, 1.0f, 0.0f,   1.0f, 1.0f,   // top right
+        0.5f, -0.5f,-0.5f,   0.0f, 1.0f, 1.0f,   1.0f, 0.0f,   // bottom right
+       -0.5f, -0.5f,-0.5f,   1.0f, 0.0f, 1.0f,   0.0f, 0.0f,   // bottom left
+       -0.5f, -0.5f, 0.5f,   0.0f, 0.0f, 1.0f,   0.0f, 1.0f,   // top left
+
+       -0.5f,  0.5f,-0.5f,   1.0f, 0.5f, 0.0f,   1.0f, 1.0f,   // top right
+       -0.5f, -0.5f,-0.5f,   1.0f, 0.0f, 1.0f,   1.0f, 0.0f,   // bottom right
+        0.5f, -0.5f,-0.5f,   0.0f, 1.0f, 1.0f,   0.0f, 0.0f,   // bottom left
+        0.5f,  0.5f,-0.5f,   1.0f, 0.0f, 0.5f,   0.0f, 1.0f,   // top left
+
+       -0.5f,  0.5f, 0.5f,   1.0f, 1.0f, 0.0f,   1.0f, 1.0f,   // top right
+       -0.5f,  0.5f,-0.5f,   1.0f, 0.5f, 0.0f,   1.0f, 0.0f,   // bottom right
+        0.5f,  0.5f,-0.5f,   1.0f, 0.0f, 0.5f,   0.0f, 0.0f,   // bottom left
+        0.5f,  0.5f, 0.5f,   1.0f, 0.0f, 0.0f,   0.0f, 1.0f,   // top left
+
+        0.5f,  0.5f,-0.5f,   1.0f, 0.0f, 0.5f,   1.0f, 1.0f,   // top right
+        0.5f, -0.5f,-0.5f,   0.0f, 1.0f, 1.0f,   1.0f, 0.0f,   // bottom right
+        0.5f, -0.5f, 0.5f,   0.0f, 1.0f, 0.0f,   0.0f, 0.0f,   // bottom left
+        0.5f,  0.5f, 0.5f,   1.0f, 0.0f, 0.0f,   0.0f, 1.0f,   // top left
+
+       -0.5f,  0.5f, 0.5f,   1.0f, 1.0f, 0.0f,   1.0f, 1.0f,   // top right
+       -0.5f, -0.5f, 0.5f,   0.0f, 0.0f, 1.0f,   1.0f, 0.0f,   // bottom right
+       -0.5f, -0.5f,-0.5f,   1.0f, 0.0f, 1.0f,   0.0f, 0.0f,   // bottom left
+       -0.5f,  0.5f,-0.5f,   1.0f, 0.5f, 0.0f,   0.0f, 1.0f,   // top left
+    };
+    GLuint indices_container[] = {
+        0, 1, 2,
+        0, 2, 3,
+
+        4, 5, 6,
+        4, 6, 7,
+
+        8, 9, 10,
+        8, 10, 11,
+
+        12, 13, 14,
+        12, 14, 15,
+
+        16, 17, 18,
+        16, 18, 19,
+
+        20, 21, 22,
+        20, 22, 23,
+    };
+
+    GLfloat vertices_tower[] = {
+         0.5f, -1.0f, 0.0f,   1.0f, 1.0f, //Нижнее основание
+        -0.5f, -1.0f,-0.5f,   1.0f, 0.0f,
+        -0.5f, -1.0f, 0.5f,   0.0f, 0.0f,
+
+         0.5f, 1.0f, 0.0f,    1.0f, 1.0f, //Верхнее основание
+        -0.5f, 1.0f,-0.5f,    1.0f, 0.0f,
+        -0.5f, 1.0f, 0.5f,    0.0f, 0.0f,
+
+         0.5f, -1.0f, 0.0f,   1.0f, 0.0f, //1-2
+        -0.5f, -1.0f,-0.5f,   0.0f, 0.0f,
+        -0.5f, 1.0f,-0.5f,    0.0f, 1.0f,
+         0.5f, 1.0f, 0.0f,    1.0f, 1.0f,
+
+        -0.5f, -1.0f,-0.5f,   1.0f, 0.0f, //2-3
+        -0.5f, -1.0f, 0.5f,   0.0f, 0.0f,
+        -0.5f, 1.0f, 0.5f,    0.0f, 1.0f,
+        -0.5f, 1.0f,-0.5f,    1.0f, 1.0f,
+
+         0.5f, 1.0f, 0.0f,    1.0f, 0.0f, //1-3
+        -0.5f, 1.0f, 0.5f,    0.0f, 0.0f,
+        -0.5f, -1.0f, 0.5f,   0.0f, 1.0f,
+         0.5f, -1.0f, 0.0f,   1.0f, 1.0f,
+    };
+    GLuint indices_tower[] = {
+        0, 1, 2,
+
+        3, 4, 5,
+
+        6, 7, 8,
+        6, 8, 9,
+
+        10, 11, 12,
+        10, 12, 13,
+
+        14, 15, 16,
+        14, 16, 17,
+    };
+
+    GLfloat vertices_pyramid3[] = {
+        -0.5f,-0.5f,-0.5f,  0.0f, 0.0f, //Основание
+         0.5f,-0.5f,-0.5f,  1.0f, 0.0f,
+         0.0f,-0.5f, 0.5f,  0.5f, 1.0f,
+
+        -0.5f,-0.5f,-0.5f,  0.0f, 0.0f, //1-2
+         0.5f,-0.5f,-0.5f,  1.0f, 0.0f,
+         0.0f, 0.5f, 0.0f,  0.5f, 1.0f,
+
+        -0.5f,-0.5f,-0.5f,  0.0f, 0.0f, //1-3
+         0.0f,-0.5f, 0.5f,  1.0f, 0.0f,
+         0.0f, 0.5f, 0.0f,  0.5f, 1.0f,
+
+         0.5f,-0.5f,-0.5f,  0.0f, 0.0f, //2-3
+         0.0f,-0.5f, 0.5f,  1.0f, 0.0f,
+         0.0f, 0.5f, 0.0f,  0.5f, 1.0f,
+    };
+    GLuint indices_pyramid3[] = {
+        0, 1, 2,
+        3, 4, 5,
+        6, 7, 8,
+        9, 10, 11,
+    };
+
+    // All meshes share one index buffer and, per vertex format, one vertex buffer and VAO
+    m_geometry.initialize();
+    // Per-instance model matrices of all mesh types, refilled every frame in instanced mode
+    setupInstanceAttributes();
+
+    // The built-in meshes are the coarsest levels; finer ones follow from the thread pool
+    MeshData coarsest[MeshKindCount];
+    coarsest[Container] = MeshLoader::fromInterleaved(vertices_container, sizeof(vertices_container) / sizeof(GLfloat) / 8, 8, 3, 6, -1,
+                                                      indices_container, sizeof(indices_container) / sizeof(GLuint));
+    coarsest[Pyramid4] = MeshLoader::fromInterleaved(vertices_pyramid4, sizeof(vertices_pyramid4) / sizeof(GLfloat) / 6, 6, -1, 3, 5,
+                                                     indices_pyramid4, sizeof(indices_pyramid4) / sizeof(GLuint));
+    coarsest[Tower] = MeshLoader::fromInterleaved(vertices_tower, sizeof(vertices_tower) / sizeof(GLfloat) / 5, 5, -1, 3, -1,
+                                                  indices_tower, sizeof(indices_tower) / sizeof(GLuint));
+    coarsest[Pyramid3] = MeshLoader::fromInterleaved(vertices_pyramid3, sizeof(vertices_pyramid3) / sizeof(GLfloat) / 5, 5, -1, 3, -1,
+                                                     indices_pyramid3, sizeof(indices_pyramid3) / sizeof(GLuint));
+    coarsest[Sphere] = MeshGenerator::sphere(CoarseSegments);
+    coarsest[Torus] = MeshGenerator::torus(CoarseSegments);
+    for (int kind = 0; kind < MeshKindCount; kind++) {
+        MeshOptimizer::optimize(coarsest[kind]);
+        uploadMesh(MeshKind(kind), coarsest[kind]);
+        generateLods(MeshKind(kind), coarsest[kind]);
+    }
+
+    // Box around a unit sphere for occlusion queries, scaled to each object's bounds
+    GLfloat vertices_box[] = {
+        -1.0f, -1.0f, -1.0f,    1.0f, -1.0f, -1.0f,    1.0f,  1.0f, -1.0f,   -1.0f,  1.0f, -1.0f,
+        -1.0f, -1.0f,  1.0f,    1.0f, -1.0f,  1.0f,    1.0f,  1.0f,  1.0f,   -1.0f,  1.0f,  1.0f,
+    };
+    GLuint indices_box[] = {
+        0, 2, 1,  0, 3, 2,
+        4, 5, 6,  4, 6, 7,
+        0, 1, 5,  0, 5, 4,
+        3, 6, 2,  3, 7, 6,
+        0, 4, 7,  0, 7, 3,
+        1, 2, 6,  1, 6, 5,
+    };
+    m_occluder = m_geometry.add(MeshLoader::fromInterleaved(vertices_box, 8, 3, -1, -1, -1, indices_box, 36).view());
+
+    // GPU timers, one ring slot per frame in flight
+    glGenQueries(QueryLatency * MeshKindCount, &m_time_queries[0][0]);
+
+    // Textures are decoded on the thread pool and streamed into the layers of one array
+    m_textures.initialize();
+    m_textures.setLayerSize(TextureLayerSize);
+    GLint cube = m_textures.load(":/img/cube.jpg", false);
+    GLint triangle = m_textures.load(":/img/triangle.jpg", true);
+    GLint wall = m_textures.load(":/img/tower_wall.jpg", false);
+    GLint triangle2 = m_textures.load(":/img/triangle2.jpg", true);
+
+    // Material slots of each mesh type; pyramid4 vertices use slot 1 for the cube-textured base
+    setMaterial(Container, cube, cube, 0.35f);
+    setMaterial(Pyramid4, triangle, cube, 0.0f);
+    setMaterial(Pyramid3, triangle2, triangle2, 0.0f);
+    setMaterial(Tower, wall, wall, 0.0f);
+    setMaterial(Sphere, cube, cube, 0.0f);
+    setMaterial(Torus, wall, wall, 0.0f);
+
+    // Prepare shader programm, from the binary cache when the driver supports it
+    m_program_cache.initialize();
+    if (!m_program_cache.build(m_program, vertexShaderSource, fragmentShaderSource))
+        qWarning("Can't link the shader program: %s", qPrintable(m_program.log()));
+    resolveUniforms();
+
+    // Camera data shared by every program through one uniform buffer binding
+    glGenBuffers(1, &m_camera_ubo);
+    glBindBuffer(GL_UNIFORM_BUFFER, m_camera_ubo);
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(CameraBlock), nullptr, GL_STREAM_DRAW);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    m_gl_state.initialize();
+
+    m_initialized = true;
+}
+void Renderer::cleanup()
+{
+    if (!m_initialized)
+        return;
+    m_initialized = false;
+    m_geometry.cleanup();
+    for (int kind = 0; kind < MeshKindCount; kind++) {
+        // A running job only holds CPU data, its result is dropped
+        m_meshes[kind].count = 0;
+        m_lod_jobs[kind] = QFuture<QVector<MeshData>>();
+        m_lod_pending[kind] = false;
+    }
+    m_occluder = -1;
+    resetOcclusionQueries();
+    m_textures.cleanup();
+    m_instance_ring.cleanup();
+    glDeleteBuffers(1, &m_camera_ubo);
+    m_camera_ubo = 0;
+    glDeleteQueries(QueryLatency * MeshKindCount, &m_time_queries[0][0]);
+    m_program.removeAllShaders();
+}
+
+void Renderer::uploadMesh(MeshKind kind, const MeshData &data)
+{
+    uploadMesh(kind, data.view());
+    m_mesh_optimize_stats[kind] = data.optimization;
+}
+void Renderer::uploadMesh(MeshKind kind, const MeshView &data)
+{
+    removeMesh(kind);
+    m_mesh_optimize_stats[kind] = MeshOptimizeStats();
+    const int handle = m_geometry.add(data);
+    m_bvh_dirty = true;
+    if (handle < 0) {
+        qWarning("Can't upload the %s mesh: unsupported vertex layout", meshNames[kind]);
+        return;
+    }
+    m_meshes[kind].levels[0] = handle;
+    m_meshes[kind].count = 1;
+}
+void Renderer::removeMesh(MeshKind kind)
+{
+    MeshLods &lods = m_meshes[kind];
+    for (int level = 0; level < lods.count; level++)
+        m_geometry.remove(lods.levels[level]);
+    lods.count = 0;
+    // Levels still being generated belong to the old mesh
+    m_lod_jobs[kind] = QFuture<QVector<MeshData>>();
+    m_lod_pending[kind] = false;
+}
+void Renderer::generateLods(MeshKind kind, const MeshData &coarsest)
+{
+    if (m_meshes[kind].count != 1)
+        return;
+    m_lod_jobs[kind] = QtConcurrent::run(finerLevels, kind, coarsest, int(MaxLodLevels) - 1);
+    m_lod_pending[kind] = true;
+}
+void Renderer::updateLods()
+{
+    for (int kind = 0; kind < MeshKindCount; kind++) {
+        if (!m_lod_pending[kind] || !m_lod_jobs[kind].isFinished())
+            continue;
+        const QVector<MeshData> levels = m_lod_jobs[kind].result();
+        m_lod_jobs[kind] = QFuture<QVector<MeshData>>();
+        m_lod_pending[kind] = false;
+        // Finer levels go in front of the uploaded mesh, which stays the coarsest
+        MeshLods &lods = m_meshes[kind];
+        const int coarsest = lods.levels[0];
+        lods.count = 0;
+        for (const MeshData &level : levels) {
+            const int handle = level.isValid() ? m_geometry.add(level.view()) : -1;
+            if (handle >= 0 && lods.count < MaxLodLevels - 1)
+                lods.levels[lods.count++] = handle;
+            else if (handle >= 0)
+                m_geometry.remove(handle);
+        }
+        lods.levels[lods.count++] = coarsest;
+        m_bvh_dirty = true;
+    }
+}
+void Renderer::resolveUniforms()
+{
+    const GLuint program = m_program.programId();
+    m_uniforms.model = m_program.uniformLocation("model");
+    m_uniforms.instanced = m_program.uniformLocation("instanced");
+    m_uniforms.layers = m_program.uniformLocation("layers");
+    m_uniforms.colorMix = m_program.uniformLocation("colorMix");
+    // Block bindings and samplers are program state, set once after linking
+    const GLuint camera = glGetUniformBlockIndex(program, "Camera");
+    if (camera != GL_INVALID_INDEX)
+        glUniformBlockBinding(program, camera, CameraBinding);
+    else
+        qWarning("The shader program has no Camera uniform block");
+    m_program.bind();
+    m_program.setUniformValue("mTextures", 0);
+    m_program.release();
+}
+void Renderer::uploadCamera(const QMatrix4x4 &view, const QMatrix4x4 &projection, const QVector3D &position)
+{
+    // QMatrix4x4 data is column-major floats, which is what std140 wants for a mat4
+    CameraBlock block;
+    const QMatrix4x4 viewProjection = projection * view;
+    memcpy(block.view, view.constData(), sizeof(block.view));
+    memcpy(block.projection, projection.constData(), sizeof(block.projection));
+    memcpy(block.viewProjection, viewProjection.constData(), sizeof(block.viewProjection));
+    block.position[0] = position.x();
+    block.position[1] = position.y();
+    block.position[2] = position.z();
+    block.position[3] = 1.0f;
+    glBindBuffer(GL_UNIFORM_BUFFER, m_camera_ubo);
+    // Orphan the old storage so the driver doesn't wait for the previous frame
+    glBufferData(GL_UNIFORM_BUFFER, sizeof(block), nullptr, GL_STREAM_DRAW);
+    glBufferSubData(GL_UNIFORM_BUFFER, 0, sizeof(block), &block);
+    glBindBuffer(GL_UNIFORM_BUFFER, 0);
+    m_gl_state.bindUniformBuffer(CameraBinding, m_camera_ubo);
+}
+void Renderer::setupInstanceAttributes()
+{
+    // The ring never has empty storage, so non-instanced draws still fetch valid data
+    m_instance_ring.initialize(InstanceRingBytes);
+    glBindBuffer(GL_ARRAY_BUFFER, 0); // Unbind current VBO
+    m_geometry.setInstanceBuffer(m_instance_ring.buffer());
+}
+void Renderer::pointInstanceAttributes(int first)
+{
+    // GL 3.3 has no base instance, so each run of the queue gets the attributes re-pointed at
+    // its part of the buffer instead. mat4 attribute takes 4 locations, one column each
+    const quintptr offset = quintptr(m_instance_ring.offset()) + quintptr(first) * 16 * sizeof(GLfloat);
+    for (GLuint i = 0; i < 4; i++)
+        glVertexAttribPointer(4 + i, 4, GL_FLOAT, GL_FALSE, 16 * sizeof(GLfloat), (void*)(offset + i * 4 * sizeof(GLfloat)));
+}
+QMatrix4x4 Renderer::sharedRotation(const FrameState &state)
+{
+    QMatrix4x4 rotation;
+    rotation.rotate(180.0f - (state.xRot / 16.0f), 1.0f, 0.0f, 0.0f);
+    rotation.rotate(state.yRot / 16.0f, 0.0f, 1.0f, 0.0f);
+    rotation.rotate(state.zRot / 16.0f, 0.0f, 0.0f, 1.0f);
+    return rotation;
+}
+void Renderer::prepareTransforms(GLfloat *out)
+{
+    // The shared rotation turns each object in its own frame, after its own rotation and
+    // scale. It is built once here; the kernel only composes it with the per-object columns.
+    // Matrices follow the sorted queue, so every run of it reads a contiguous range
+    const QMatrix4x4 shared = sharedRotation(m_state);
+    const int count = m_queue.size();
+    m_transform_jobs.clear();
+    for (int first = 0; first < count; first += TransformChunk) {
+        TransformJob job;
+        job.objectSlots = m_queue.values() + first;
+        job.count = qMin<int>(TransformChunk, count - first);
+        job.out = out + 16 * first;
+        m_transform_jobs.append(job);
+    }
+    const EntityStore &objects = m_objects;
+    auto compose = [&shared, &objects](const TransformJob &job) {
+        composeModelMatrices(shared, objects.positions(), objects.rotations(), objects.scales(),
+                             job.objectSlots, job.count, job.out);
+    };
+    // Chunks are handed out to idle pool threads and the calling thread as they finish,
+    // so uneven chunks still keep every core busy
+    if (m_transform_jobs.size() > 1)
+        QtConcurrent::blockingMap(m_transform_jobs, compose);
+    else if (!m_transform_jobs.isEmpty())
+        compose(m_transform_jobs.first());
+}
+void Renderer::uploadInstances()
+{
+    const int total = m_queue.size();
+    if (total == 0)
+        return;
+    // The pool writes straight into the mapped region; the GL thread only maps and unmaps
+    const qint64 bytes = qint64(total) * 16 * sizeof(GLfloat);
+    GLfloat *mapped = static_cast<GLfloat *>(m_instance_ring.map(bytes));
+    if (mapped) {
+        prepareTransforms(mapped);
+        if (m_instance_ring.unmap())
+            return;
+    }
+    // Mapping failed or the contents got lost, go through client memory
+    m_instance_data.resize(total * 16);
+    prepareTransforms(m_instance_data.data());
+    glBufferSubData(GL_ARRAY_BUFFER, m_instance_ring.offset(), bytes, m_instance_data.constData());
+}
+void Renderer::rebuildBvh()
+{
+    // The shared rotation turns every mesh around its origin, so a sphere around the
+    // object position that holds the scaled mesh in any orientation never goes stale
+    float radius[MeshKindCount];
+    for (int kind = 0; kind < MeshKindCount; kind++) {
+        radius[kind] = 0.0f;
+        for (int level = 0; level < m_meshes[kind].count; level++) {
+            const GeometryArena::Range &mesh = m_geometry.range(m_meshes[kind].levels[level]);
+            radius[kind] = qMax(radius[kind], ((mesh.boundsMin + mesh.boundsMax) / 2.0f).length() + mesh.radius);
+        }
+    }
+    const int count = m_objects.size();
+    const QVector3D *positions = m_objects.positions();
+    const QVector3D *scales = m_objects.scales();
+    const quint16 *meshes = m_objects.meshes();
+    m_cull_spheres.resize(count);
+    for (int slot = 0; slot < count; slot++) {
+        const QVector3D &scale = scales[slot];
+        const float extent = qMax(qAbs(scale.x()), qMax(qAbs(scale.y()), qAbs(scale.z())));
+        m_cull_spheres[slot] = QVector4D(positions[slot], radius[meshes[slot]] * extent);
+    }
+    m_bvh.build(m_cull_spheres);
+    m_bvh_dirty = false;
+    m_bvh_version = m_objects.version();
+    // Sphere numbers changed, old query results belong to other objects now
+    resetOcclusionQueries();
+}
+void Renderer::cull(const QMatrix4x4 &viewProjection)
+{
+    QElapsedTimer timer;
+    timer.start();
+    if (m_bvh_dirty || m_bvh_version != m_objects.version())
+        rebuildBvh();
+    m_cull_result.clear();
+    m_bvh.cull(Frustum::fromMatrix(viewProjection), m_cull_result);
+    m_cull_stats.objects = m_bvh.size();
+    m_cull_stats.visible = m_cull_result.size();
+    m_cull_stats.occluded = 0;
+    m_cull_stats.cpuMs = timer.nsecsElapsed() / 1.0e6;
+}
+void Renderer::buildQueue(const QVector3D &cameraPos, const QVector3D &cameraFront, float pixelScale)
+{
+    QElapsedTimer timer;
+    timer.start();
+    int pools[MeshKindCount][MaxLodLevels];
+    int triangles[MeshKindCount][MaxLodLevels];
+    for (int kind = 0; kind < MeshKindCount; kind++) {
+        for (int level = 0; level < m_meshes[kind].count; level++) {
+            const GeometryArena::Range &mesh = m_geometry.range(m_meshes[kind].levels[level]);
+            pools[kind][level] = mesh.pool;
+            triangles[kind][level] = mesh.indexCount / 3;
+        }
+    }
+    // New slots start from the coarsest level
+    const int known = m_lod_levels.size();
+    m_lod_levels.resize(m_objects.size());
+    for (int slot = known; slot < m_lod_levels.size(); slot++)
+        m_lod_levels[slot] = quint8(MaxLodLevels - 1);
+    LodStats lod;
+    lod.triangles = 0;
+    lod.bias = m_lod_bias;
+    for (int &objects : lod.objects)
+        objects = 0;
+
+    const QVector3D forward = cameraFront.normalized();
+    const QVector3D *positions = m_objects.positions();
+    const quint16 *meshes = m_objects.meshes();
+    const quint16 *materials = m_objects.materials();
+    int occluded = 0;
+    m_queue.clear();
+    for (int slot : m_cull_result) {
+        const int mesh = meshes[slot];
+        if (m_meshes[mesh].count == 0)
+            continue;
+        if (m_occlusion) {
+            const bool hidden = wasOccluded(slot);
+            if (hidden)
+                occluded++;
+            // Conditional rendering decides per draw call, so the instanced path drops
+            // hidden instances here instead, a frame or two later than the GPU would
+            if (hidden && m_instanced)
+                continue;
+        }
+        const QVector3D offset = positions[slot] - cameraPos;
+        const float distance = qMax(offset.length(), NearPlane);
+        const int level = selectLod(slot, m_meshes[mesh].count, m_cull_spheres[slot].w() * pixelScale / distance);
+        lod.objects[level]++;
+        lod.triangles += triangles[mesh][level];
+        const float depth = QVector3D::dotProduct(offset, forward) / FarPlane;
+        m_queue.add(RenderQueue::makeKey(0, mesh, pools[mesh][level], level, materials[slot], depth), slot);
+    }
+    m_queue.sort();
+    m_cull_stats.occluded = occluded;
+    m_cull_stats.queueMs = timer.nsecsElapsed() / 1.0e6;
+
+    // Over budget every threshold grows, which moves the objects that are smallest on screen
+    // to coarser levels first. The gap between the two bounds keeps the bias from oscillating
+    if (lod.triangles > m_triangle_budget)
+        m_lod_bias = qMin(m_lod_bias * 1.25f, MaxLodBias);
+    else if (lod.triangles < m_triangle_budget / 2)
+        m_lod_bias = qMax(m_lod_bias / 1.1f, 1.0f);
+    m_lod_stats = lod;
+}
+int Renderer::selectLod(int slot, int count, float screenRadius)
+{
+    int level = qMin<int>(m_lod_levels[slot], count - 1);
+    const float finer = m_lod_bias * (1.0f + LodHysteresis);
+    const float coarser = m_lod_bias * (1.0f - LodHysteresis);
+    while (level > 0 && screenRadius >= LodThresholds[level - 1] * finer)
+        level--;
+    while (level < count - 1 && screenRadius < LodThresholds[level] * coarser)
+        level++;
+    m_lod_levels[slot] = quint8(level);
+    return level;
+}
+void Renderer::resetOcclusionQueries()
+{
+    for (int slot = 0; slot < QueryLatency; slot++) {
+        if (!m_occlusion_queries[slot].isEmpty())
+            glDeleteQueries(m_occlusion_queries[slot].size(), m_occlusion_queries[slot].constData());
+        m_occlusion_queries[slot].clear();
+        m_occlusion_frames[slot].clear();
+    }
+}
+void Renderer::allocateOcclusionQueries()
+{
+    // Created on first use after the BVH has numbered the spheres
+    const int count = m_cull_spheres.size();
+    if (m_occlusion_queries[0].size() == count)
+        return;
+    resetOcclusionQueries();
+    for (int slot = 0; slot < QueryLatency; slot++) {
+        m_occlusion_queries[slot].resize(count);
+        m_occlusion_frames[slot].fill(-QueryLatency - 1, count);
+        if (count > 0)
+            glGenQueries(count, m_occlusion_queries[slot].data());
+    }
+}
+bool Renderer::wasOccluded(int sphere)
+{
+    // The newest result that is already available, so the CPU never waits for the GPU.
+    // A frame the object wasn't queried in ends the search: older results are stale
+    for (int age = 1; age <= QueryLatency; age++) {
+        const int slot = (m_frame - age + QueryLatency) % QueryLatency;
+        if (m_occlusion_frames[slot][sphere] != m_frame - age)
+            return false;
+        GLuint available = 0;
+        glGetQueryObjectuiv(m_occlusion_queries[slot][sphere], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (available) {
+            GLuint samples = 0;
+            glGetQueryObjectuiv(m_occlusion_queries[slot][sphere], GL_QUERY_RESULT, &samples);
+            return samples == 0;
+        }
+    }
+    return false;
+}
+void Renderer::queryOcclusion(const QVector3D &cameraPos)
+{
+    if (m_occluder < 0)
+        return;
+    const GeometryArena::Range &box = m_geometry.range(m_occluder);
+    m_gl_state.bindVertexArray(m_geometry.vao(box.pool));
+    // Depth test only: the boxes are tested against the finished depth buffer of this frame
+    glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+    glDepthMask(GL_FALSE);
+    if (m_instanced)
+        m_program.setUniformValue(m_uniforms.instanced, GLint(0));
+    const int slot = m_frame % QueryLatency;
+    for (int sphere : m_cull_result) {
+        const QVector3D center = m_cull_spheres[sphere].toVector3D();
+        const float radius = m_cull_spheres[sphere].w();
+        // The near plane cuts into a box around the camera, which then may pass no samples
+        // while the object is right in front of it. Leave such objects unqueried, they are
+        // drawn unconditionally next frame
+        const QVector3D offset = cameraPos - center;
+        const float reach = radius + 3.0f * NearPlane;
+        if (qAbs(offset.x()) < reach && qAbs(offset.y()) < reach && qAbs(offset.z()) < reach)
+            continue;
+        QMatrix4x4 model;
+        model.translate(center);
+        model.scale(radius);
+        m_program.setUniformValue(m_uniforms.model, model);
+        glBeginQuery(GL_ANY_SAMPLES_PASSED, m_occlusion_queries[slot][sphere]);
+        glDrawElementsBaseVertex(GL_TRIANGLES, box.indexCount, box.indexType, (void*)box.indexOffset, box.baseVertex);
+        glEndQuery(GL_ANY_SAMPLES_PASSED);
+        m_occlusion_frames[slot][sphere] = m_frame;
+    }
+    glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+    glDepthMask(GL_TRUE);
+}
+void Renderer::collectGpuTimes()
+{
+    // The slot about to be reused was issued QueryLatency frames ago, so its results are
+    // normally ready. If they aren't, keep the old value rather than stall the pipeline.
+    if (m_frame < QueryLatency)
+        return;
+    int slot = m_frame % QueryLatency;
+    for (int kind = 0; kind < MeshKindCount; kind++) {
+        GLuint available = 0;
+        glGetQueryObjectuiv(m_time_queries[slot][kind], GL_QUERY_RESULT_AVAILABLE, &available);
+        if (!available)
+            continue;
+        GLuint64 ns = 0;
+        glGetQueryObjectui64v(m_time_queries[slot][kind], GL_QUERY_RESULT, &ns);
+        m_stats[kind].gpuMs = ns / 1.0e6;
+    }
+}
+void Renderer::beginGroup(MeshKind kind)
+{
+    m_stats[kind].drawCalls = 0;
+    m_stats[kind].triangles = 0;
+    glBeginQuery(GL_TIME_ELAPSED, m_time_queries[m_frame % QueryLatency][kind]);
+    m_group_timer.start();
+}
+void Renderer::endGroup(MeshKind kind)
+{
+    m_stats[kind].cpuMs = m_group_timer.nsecsElapsed() / 1.0e6;
+    glEndQuery(GL_TIME_ELAPSED);
+}
+void Renderer::setMaterial(int material, GLint layer0, GLint layer1, GLfloat colorMix)
+{
+    m_materials[material].layers[0] = layer0;
+    m_materials[material].layers[1] = layer1;
+    m_materials[material].colorMix = colorMix;
+}
+void Renderer::drawQueue()
+{
+    const quint64 *keys = m_queue.keys();
+    const int count = m_queue.size();
+    bool timed[MeshKindCount] = {};
+    int group = -1;
+    for (int first = 0; first < count; ) {
+        // A run shares everything but depth: one instanced draw, or a loop of plain ones
+        const quint64 state = RenderQueue::stateOf(keys[first]);
+        int end = first + 1;
+        while (end < count && RenderQueue::stateOf(keys[end]) == state)
+            end++;
+        const int kind = RenderQueue::meshOf(keys[first]);
+        if (kind != group) {
+            if (group >= 0)
+                endGroup(MeshKind(group));
+            beginGroup(MeshKind(kind));
+            timed[kind] = true;
+            group = kind;
+        }
+        drawRun(MeshKind(kind), RenderQueue::lodOf(keys[first]), RenderQueue::materialOf(keys[first]), first, end - first);
+        first = end;
+    }
+    if (group >= 0)
+        endGroup(MeshKind(group));
+    // Every timer slot gets read back, so mesh types with nothing to draw get an empty group
+    for (int kind = 0; kind < MeshKindCount; kind++) {
+        if (!timed[kind]) {
+            beginGroup(MeshKind(kind));
+            endGroup(MeshKind(kind));
+        }
+    }
+}
+void Renderer::drawRun(MeshKind kind, int lod, int material, int first, int count)
+{
+    const GeometryArena::Range &mesh = m_geometry.range(m_meshes[kind].levels[lod]);
+    const void *indices = (void*)mesh.indexOffset;
+    // Mesh types of the same vertex format share a VAO
+    m_gl_state.bindVertexArray(m_geometry.vao(mesh.pool));
+    if (m_bound_material != material) {
+        m_bound_material = material;
+        m_program.setUniformValueArray(m_uniforms.layers, m_materials[material].layers, MaterialSlots);
+        m_program.setUniformValue(m_uniforms.colorMix, m_materials[material].colorMix);
+    }
+    m_stats[kind].triangles += mesh.indexCount / 3 * count;
+    if (m_instanced) {
+        pointInstanceAttributes(first);
+        glDrawElementsInstancedBaseVertex(GL_TRIANGLES, mesh.indexCount, mesh.indexType, indices,
+                                          count, mesh.baseVertex);
+        m_stats[kind].drawCalls++;
+        return;
+    }
+    const int previous = (m_frame + QueryLatency - 1) % QueryLatency;
+    const int *queued = m_queue.values() + first;
+    const GLfloat *model = m_instance_data.constData() + 16 * first;
+    for (int i = 0; i < count; i++, model += 16) {
+        // The GPU skips the draw if the box query of the last frame saw no samples
+        const int slot = queued[i];
+        const bool conditional = m_occlusion && m_occlusion_frames[previous][slot] == m_frame - 1;
+        if (conditional)
+            glBeginConditionalRender(m_occlusion_queries[previous][slot], GL_QUERY_NO_WAIT);
+        glUniformMatrix4fv(m_uniforms.model, 1, GL_FALSE, model);
+        glDrawElementsBaseVertex(GL_TRIANGLES, mesh.indexCount, mesh.indexType, indices, mesh.baseVertex);
+        if (conditional)
+            glEndConditionalRender();
+        m_stats[kind].drawCalls++;
+    }
+}
+void Renderer::render(const FrameState &state, int width, int height)
+{
+    m_state = state;
+    collectGpuTimes();
+
+    // QPainter overlays (the HUD) leave their own state behind
+    glEnable(GL_DEPTH_TEST);
+    glDepthMask(GL_TRUE);
+    glDisable(GL_BLEND);
+    glDisable(GL_SCISSOR_TEST);
+    glDisable(GL_STENCIL_TEST);
+    glDisable(GL_CULL_FACE);
+
+    m_textures.update();
+    updateLods();
+    // Everything above, the HUD and mesh uploads bind behind the state cache's back
+    m_gl_state.invalidate();
+    m_gl_state.resetCounters();
+
+    glClearColor(0.95f, 0.95f, 0.95f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+    // Every material lives in one array texture, bound once per frame
+    m_gl_state.bindTexture(0, GL_TEXTURE_2D_ARRAY, m_textures.texture());
+
+    QMatrix4x4 view;
+    QMatrix4x4 projection;
+
+    view.lookAt(state.cameraPos, state.cameraPos + state.cameraFront, state.cameraUp);
+    projection.perspective(FieldOfView, float(width) / height, NearPlane, FarPlane);
+    cull(projection * view);
+    if (m_occlusion)
+        allocateOcclusionQueries();
+    // Pixels per unit of size at unit distance, for the projected size of the objects
+    const float pixelScale = height / (2.0f * qTan(qDegreesToRadians(FieldOfView) / 2.0f));
+    buildQueue(state.cameraPos, state.cameraFront, pixelScale);
+
+    uploadCamera(view, projection, state.cameraPos);
+    m_gl_state.useProgram(m_program.programId());
+    m_program.setUniformValue(m_uniforms.instanced, GLint(m_instanced));
+    m_bound_material = -1;
+
+    // In instanced mode the instance buffer stays bound for re-pointing
+    if (m_instanced) {
+        uploadInstances();
+    }
+    else {
+        m_instance_data.resize(m_queue.size() * 16);
+        prepareTransforms(m_instance_data.data());
+    }
+    drawQueue();
+    if (m_occlusion)
+        queryOcclusion(state.cameraPos);
+    // The ring region may be reused once the GPU is past this point
+    if (m_instanced)
+        m_instance_ring.fence();
+
+    m_gl_state.bindVertexArray(0);
+    glBindBuffer(GL_ARRAY_BUFFER, 0);
+    m_frame++;
+}
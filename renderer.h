@@ -0,0 +1,265 @@
+#ifndef RENDERER_H
+#define RENDERER_H
+
+#include <QtOpenGL>
+#include <QOpenGLFunctions_3_3_Core>
+
+#include "bvh.h"
+#include "entitystore.h"
+#include "geometryarena.h"
+#include "glstatecache.h"
+#include "meshloader.h"
+#include "programcache.h"
+#include "renderqueue.h"
+#include "streamring.h"
+#include "texturestreamer.h"
+
+// Camera and rotation state the scene is drawn with
+struct FrameState
+{
+    QVector3D cameraPos;
+    QVector3D cameraFront;
+    QVector3D cameraUp;
+    int xRot;
+    int yRot;
+    int zRot;
+};
+
+// Wraps an angle in 1/16 degree into [0, 360 * 16]
+inline void qNormalizeAngle(int &angle)
+{
+    while (angle < 0)
+        angle += 360 * 16;
+    while (angle > 360 * 16)
+        angle -= 360 * 16;
+}
+
+// Owns all GL objects of the scene and draws it into the currently bound framebuffer.
+// Used by SceneDriver and by the headless benchmark, so it must not depend on any widget.
+class Renderer : protected QOpenGLFunctions_3_3_Core
+{
+public:
+    // Mesh types, also used as index into per-type arrays
+    enum MeshKind {
+        Container,
+        Pyramid4,
+        Pyramid3,
+        Tower,
+        Sphere,
+        Torus,
+        MeshKindCount
+    };
+    // Levels of detail per mesh type, level 0 is the finest
+    enum { MaxLodLevels = 4 };
+
+    // Per draw group numbers of the last frame. gpuMs lags QueryLatency frames behind and
+    // stays negative until the first timer query result arrives.
+    struct GroupStats {
+        double gpuMs;
+        double cpuMs;
+        int drawCalls;
+        int triangles;
+    };
+
+    // Culling of the last frame. occluded counts visible objects whose latest available
+    // occlusion query saw no samples, it stays 0 while occlusion culling is off
+    struct CullStats {
+        int objects;
+        int visible;
+        int occluded;
+        double cpuMs;
+        double queueMs; // building and sorting the render queue
+    };
+
+    // Levels of detail of the last frame. bias scales the screen size thresholds up while
+    // the queued triangles exceed the budget, and back down once they are well below it
+    struct LodStats {
+        int triangles;
+        float bias;
+        int objects[MaxLodLevels]; // queued objects per level
+    };
+
+    Renderer();
+    ~Renderer();
+
+    // All of these need a current GL 3.3 context
+    void initialize();
+    void render(const FrameState &state, int width, int height);
+    void cleanup();
+    // Assets are streamed in over several frames; these need a current context too
+    bool loading() const;
+    void finishLoading();
+
+    void setInstanced(bool enabled);
+    bool instanced() const { return m_instanced; }
+    void setOcclusionCulling(bool enabled);
+    bool occlusionCulling() const { return m_occlusion; }
+    // Triangles the queued levels of detail may add up to before all objects get coarser
+    void setTriangleBudget(int triangles);
+    int triangleBudget() const { return m_triangle_budget; }
+    // Scene objects, see EntityStore. material indexes the material table, which has one
+    // entry per mesh type; -1 takes the one of the mesh type
+    int addObject(MeshKind kind, const QVector3D &position, const QQuaternion &rotation = QQuaternion(),
+                  const QVector3D &scale = QVector3D(1.0f, 1.0f, 1.0f), int material = -1);
+    void removeObject(int handle);
+    void clearObjects();
+    const EntityStore &objects() const { return m_objects; }
+    // Replaces the geometry of a mesh type, e.g. with one parsed by MeshLoader. The mesh
+    // becomes the only level of detail of the type
+    void uploadMesh(MeshKind kind, const MeshData &data);
+    void uploadMesh(MeshKind kind, const MeshView &data);
+
+    const GroupStats &groupStats(MeshKind kind) const { return m_stats[kind]; }
+    const CullStats &cullStats() const { return m_cull_stats; }
+    const LodStats &lodStats() const { return m_lod_stats; }
+    // What MeshOptimizer did to the uploaded mesh of a type, zero if it wasn't optimized
+    const MeshOptimizeStats &meshOptimizeStats(MeshKind kind) const { return m_mesh_optimize_stats[kind]; }
+    // Binds of the last frame the state cache let through and dropped
+    const GlStateCache::Counters &stateCounters() const { return m_gl_state.counters(); }
+    const ProgramCache::Stats &programCacheStats() const { return m_program_cache.stats(); }
+    // GPU memory of all meshes, and how much the compact vertex formats save over plain floats
+    qint64 geometryBytes() const { return m_geometry.bytesUsed(); }
+    qint64 geometryBytesSaved() const { return m_geometry.bytesSaved(); }
+    // Size of one region of the instance buffer ring, and how often the CPU had to wait for it
+    qint64 instanceRingBytes() const { return m_instance_ring.regionBytes(); }
+    int instanceRingWaits() const { return m_instance_ring.waits(); }
+    // Rotation every object spins by, from the angles of the frame
+    static QMatrix4x4 sharedRotation(const FrameState &state);
+    static const char *meshName(MeshKind kind);
+    static bool meshKindFromName(const QString &name, MeshKind &kind);
+
+private:
+    bool m_initialized;
+
+    // Shader programm shared by all mesh types
+    ProgramCache m_program_cache;
+    QOpenGLShaderProgram m_program;
+    // Uniform locations, looked up once after linking
+    struct Uniforms {
+        GLint model;
+        GLint instanced;
+        GLint layers;
+        GLint colorMix;
+    };
+    Uniforms m_uniforms;
+    int m_bound_material; // whose layers and colorMix the program holds, -1 - unknown
+
+    // std140 layout of the Camera uniform block, shared by all programs at CameraBinding
+    enum { CameraBinding = 0 };
+    struct CameraBlock {
+        GLfloat view[16];
+        GLfloat projection[16];
+        GLfloat viewProjection[16];
+        GLfloat position[4];
+    };
+    GLuint m_camera_ubo;
+
+    // Drops program, VAO, texture and uniform buffer binds that change nothing
+    GlStateCache m_gl_state;
+
+    // Uploaded geometry: arena handles of the levels of each mesh type, finest first. The
+    // coarsest level is the mesh uploaded for the type; finer ones are generated from it on
+    // the thread pool and added by updateLods() once ready
+    struct MeshLods {
+        int levels[MaxLodLevels];
+        int count; // 0 - nothing uploaded
+    };
+    GeometryArena m_geometry;
+    MeshLods m_meshes[MeshKindCount];
+    MeshOptimizeStats m_mesh_optimize_stats[MeshKindCount];
+    QFuture<QVector<MeshData>> m_lod_jobs[MeshKindCount];
+    bool m_lod_pending[MeshKindCount];
+
+    // Level of detail picked per object slot from its projected size, kept between frames
+    // for the hysteresis
+    QVector<quint8> m_lod_levels;
+    int m_triangle_budget;
+    float m_lod_bias;
+    LodStats m_lod_stats;
+
+    // All textures are layers of one array; layers are resampled to a common size
+    enum { TextureLayerSize = 512 };
+    TextureStreamer m_textures;
+
+    // Material table: texture array layer for each vertex material slot, and how much
+    // of the vertex color is mixed in. Entry N is the default of mesh type N
+    enum { MaterialSlots = 2, MaterialCount = MeshKindCount };
+    struct Material {
+        GLint layers[MaterialSlots];
+        GLfloat colorMix;
+    };
+    Material m_materials[MaterialCount];
+
+    EntityStore m_objects;
+
+    // Model matrices of the queued objects in queue order, built every frame on the thread
+    // pool in chunks of TransformChunk objects. Instanced rendering writes them into a region
+    // of m_instance_ring and reads them at attribute locations 4-7, the other path keeps them
+    // in m_instance_data and sets them as uniforms
+    enum { TransformChunk = 4096, InstanceRingBytes = 64 * 1024 };
+    struct TransformJob {
+        const int *objectSlots;
+        int count;
+        GLfloat *out;
+    };
+    bool m_instanced;
+    StreamRing m_instance_ring;
+    QVector<GLfloat> m_instance_data;
+    QVector<TransformJob> m_transform_jobs;
+
+    FrameState m_state;
+
+    // Frustum culling: a BVH over the bounding spheres of all objects, sphere N is the object
+    // in slot N. Rebuilt when objects or meshes change
+    Bvh m_bvh;
+    bool m_bvh_dirty;
+    quint32 m_bvh_version;
+    QVector<QVector4D> m_cull_spheres;
+    QVector<int> m_cull_result;
+    CullStats m_cull_stats;
+    // Slots to draw this frame, sorted by state and depth
+    RenderQueue m_queue;
+
+    // GL_TIME_ELAPSED queries per group, read back QueryLatency frames later to avoid stalls
+    enum { QueryLatency = 4 };
+    GLuint m_time_queries[QueryLatency][MeshKindCount];
+    int m_frame;
+    GroupStats m_stats[MeshKindCount];
+    QElapsedTimer m_group_timer;
+
+    // Occlusion culling: after the scene is drawn, every object that passed the frustum test
+    // gets a GL_ANY_SAMPLES_PASSED query on its bounding box, and the next frame draws it under
+    // glBeginConditionalRender on that query. Queries are per sphere and frame slot;
+    // m_occlusion_frames holds the frame each one was issued in
+    bool m_occlusion;
+    int m_occluder; // arena handle of the box drawn for the queries
+    QVector<GLuint> m_occlusion_queries[QueryLatency];
+    QVector<int> m_occlusion_frames[QueryLatency];
+
+    void rebuildBvh();
+    void cull(const QMatrix4x4 &viewProjection);
+    void buildQueue(const QVector3D &cameraPos, const QVector3D &cameraFront, float pixelScale);
+    int selectLod(int slot, int count, float screenRadius);
+    void generateLods(MeshKind kind, const MeshData &coarsest);
+    void updateLods();
+    void removeMesh(MeshKind kind);
+    void resetOcclusionQueries();
+    void allocateOcclusionQueries();
+    bool wasOccluded(int sphere);
+    void queryOcclusion(const QVector3D &cameraPos);
+    void collectGpuTimes();
+    void beginGroup(MeshKind kind);
+    void endGroup(MeshKind kind);
+
+    void resolveUniforms();
+    void uploadCamera(const QMatrix4x4 &view, const QMatrix4x4 &projection, const QVector3D &position);
+    void setupInstanceAttributes();
+    void pointInstanceAttributes(int first);
+    void prepareTransforms(GLfloat *out);
+    void uploadInstances();
+    void setMaterial(int material, GLint layer0, GLint layer1, GLfloat colorMix);
+    void drawQueue();
+    void drawRun(MeshKind kind, int lod, int material, int first, int count);
+};
+
+#endif // RENDERER_H
@@ -0,0 +1,55 @@
+#include "renderqueue.h"
+
+#include <cstring>
+
+quint64 RenderQueue::makeKey(int program, int mesh, int vao, int lod, int material, float depth)
+{
+    const quint64 state = (quint64(program & 0xff) << 32) | (quint64(mesh & 0xff) << 24)
+                        | (quint64(vao & 0xff) << 16) | (quint64(lod & 0xff) << 8) | quint64(material & 0xff);
+    const quint32 quantized = quint32(qBound(0.0, double(depth), 1.0) * double((1 << DepthBits) - 1));
+    return (state << DepthBits) | quantized;
+}
+
+void RenderQueue::clear()
+{
+    m_keys.clear();
+    m_values.clear();
+}
+void RenderQueue::sort()
+{
+    const int count = m_keys.size();
+    if (count < 2)
+        return;
+    // All eight histograms in one pass over the keys
+    int counts[8][256];
+    memset(counts, 0, sizeof(counts));
+    for (quint64 key : m_keys) {
+        for (int byte = 0; byte < 8; byte++)
+            counts[byte][(key >> (8 * byte)) & 0xff]++;
+    }
+    m_scratch_keys.resize(count);
+    m_scratch_values.resize(count);
+    for (int byte = 0; byte < 8; byte++) {
+        const int shift = 8 * byte;
+        int *offsets = counts[byte];
+        if (offsets[(m_keys[0] >> shift) & 0xff] == count)
+            continue;
+        int offset = 0;
+        for (int digit = 0; digit < 256; digit++) {
+            const int digits = offsets[digit];
+            offsets[digit] = offset;
+            offset += digits;
+        }
+        const quint64 *keys = m_keys.constData();
+        const int *values = m_values.constData();
+        quint64 *sortedKeys = m_scratch_keys.data();
+        int *sortedValues = m_scratch_values.data();
+        for (int i = 0; i < count; i++) {
+            const int target = offsets[(keys[i] >> shift) & 0xff]++;
+            sortedKeys[target] = keys[i];
+            sortedValues[target] = values[i];
+        }
+        m_keys.swap(m_scratch_keys);
+        m_values.swap(m_scratch_values);
+    }
+}
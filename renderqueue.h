@@ -0,0 +1,41 @@
+#ifndef RENDERQUEUE_H
+#define RENDERQUEUE_H
+
+#include <QVector>
+
+// Draw items ordered by a 64-bit key. The state a draw needs sits in the high 40 bits and the
+// view depth in the low 24, so after sort() draws sharing all state are adjacent and each such
+// run goes front to back. From the top: program, mesh, VAO, level of detail, material. The
+// mesh comes first so all draws of a mesh type stay in one timed group even though its levels
+// may live in different VAOs; a VAO change re-validates vertex state while a material only
+// changes two uniforms, hence VAO above material.
+class RenderQueue
+{
+public:
+    enum { DepthBits = 24 };
+
+    // depth is view distance scaled to [0, 1], values outside are clamped
+    static quint64 makeKey(int program, int mesh, int vao, int lod, int material, float depth);
+    static quint64 stateOf(quint64 key) { return key >> DepthBits; }
+    static int meshOf(quint64 key) { return int((key >> 48) & 0xff); }
+    static int lodOf(quint64 key) { return int((key >> 32) & 0xff); }
+    static int materialOf(quint64 key) { return int((key >> 24) & 0xff); }
+
+    void clear();
+    void add(quint64 key, int value) { m_keys.append(key); m_values.append(value); }
+    // LSD radix sort on bytes, stable. Bytes all keys share are skipped, which in a small
+    // scene is most of the state bits
+    void sort();
+
+    int size() const { return m_keys.size(); }
+    const quint64 *keys() const { return m_keys.constData(); }
+    const int *values() const { return m_values.constData(); }
+
+private:
+    QVector<quint64> m_keys;
+    QVector<int> m_values;
+    QVector<quint64> m_scratch_keys;
+    QVector<int> m_scratch_values;
+};
+
+#endif // RENDERQUEUE_H
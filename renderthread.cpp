@@ -0,0 +1,166 @@
+#include "renderthread.h"
+
+#include <QElapsedTimer>
+#include <QOpenGLContext>
+#include <QOpenGLFunctions>
+#include <QOpenGLPaintDevice>
+#include <QWindow>
+
+RenderThread::RenderThread(QWindow *window)
+{
+    m_window = window;
+    m_fps_cap = 0;
+    m_device_pixel_ratio = 1.0;
+    m_exposed = false;
+    for (bool &pending : m_mesh_pending)
+        pending = false;
+    m_auto_rotate.storeRelease(m_scene.autoRotate() ? 1 : 0);
+}
+RenderThread::~RenderThread()
+{
+    stop();
+}
+
+void RenderThread::post(const Command &command)
+{
+    // Only a render thread stuck for a thousand events fills the queue
+    if (!m_commands.push(command))
+        qWarning("Render thread: command queue is full, dropping a command");
+    m_wake.release();
+}
+void RenderThread::postInput(const InputEvent &input)
+{
+    Command command(Command::Input);
+    command.input = input;
+    post(command);
+}
+void RenderThread::postSurface(const QSize &size, qreal devicePixelRatio, bool exposed)
+{
+    Command command(Command::Surface);
+    command.size = size;
+    command.devicePixelRatio = devicePixelRatio;
+    command.exposed = exposed;
+    post(command);
+}
+void RenderThread::postMesh(Renderer::MeshKind kind, const QString &path)
+{
+    Command command(Command::Mesh);
+    command.kind = kind;
+    command.path = path;
+    post(command);
+}
+void RenderThread::stop()
+{
+    requestInterruption();
+    m_wake.release();
+    wait();
+}
+
+bool RenderThread::processCommands()
+{
+    bool dirty = false;
+    Command command;
+    while (m_commands.pop(command)) {
+        switch (command.type) {
+        case Command::Input:
+            dirty |= m_scene.liveInput(command.input);
+            break;
+        case Command::Surface:
+            m_size = command.size;
+            m_device_pixel_ratio = command.devicePixelRatio;
+            m_exposed = command.exposed;
+            // An expose or resize of a shown window asks for its contents again
+            dirty |= m_exposed;
+            break;
+        case Command::Mesh:
+            // Parsing runs on the thread pool, the upload happens here before a frame
+            m_mesh_jobs[command.kind] = MeshLoader::loadAsync(command.path);
+            m_mesh_pending[command.kind] = true;
+            break;
+        }
+    }
+    const int rotating = m_scene.autoRotate() ? 1 : 0;
+    if (m_auto_rotate.loadAcquire() != rotating) {
+        m_auto_rotate.storeRelease(rotating);
+        emit rotationTypeChanged();
+    }
+    return dirty;
+}
+bool RenderThread::meshesLoaded() const
+{
+    for (int kind = 0; kind < Renderer::MeshKindCount; kind++) {
+        if (m_mesh_pending[kind] && m_mesh_jobs[kind].isFinished())
+            return true;
+    }
+    return false;
+}
+void RenderThread::uploadMeshes()
+{
+    for (int kind = 0; kind < Renderer::MeshKindCount; kind++) {
+        if (!m_mesh_pending[kind] || !m_mesh_jobs[kind].isFinished())
+            continue;
+        const MeshData mesh = m_mesh_jobs[kind].result();
+        m_mesh_jobs[kind] = QFuture<MeshData>();
+        m_mesh_pending[kind] = false;
+        if (!mesh.isValid()) {
+            qWarning("Can't load mesh: %s", qPrintable(mesh.error));
+            continue;
+        }
+        m_scene.renderer().uploadMesh(Renderer::MeshKind(kind), mesh);
+    }
+}
+
+void RenderThread::run()
+{
+    // Created here, so the context belongs to this thread
+    QOpenGLContext context;
+    context.setFormat(m_window->requestedFormat());
+    if (!context.create()) {
+        qCritical("Render thread: can't create an OpenGL context");
+        return;
+    }
+
+    bool initialized = false;
+    bool dirty = true; // a frame is due even if nothing animates
+    QElapsedTimer frameClock;
+    while (!isInterruptionRequested()) {
+        dirty |= processCommands();
+        dirty |= meshesLoaded();
+        if (!m_exposed || m_size.isEmpty() || !(dirty || m_scene.animating())) {
+            // Sleep until the next post, waking now and then for loaded meshes. Posts made
+            // while frames were being drawn are taken in the same go
+            m_wake.tryAcquire(qMax(1, m_wake.available()), IdleWaitMs);
+            continue;
+        }
+        m_wake.tryAcquire(m_wake.available());
+        dirty = false;
+
+        if (!context.makeCurrent(m_window)) {
+            qCritical("Render thread: can't make the window current");
+            break;
+        }
+        if (!initialized) {
+            m_scene.initialize();
+            initialized = true;
+        }
+        uploadMeshes();
+
+        if (m_fps_cap > 0 && frameClock.isValid()) {
+            const qint64 wait = 1000 / m_fps_cap - frameClock.elapsed();
+            if (wait > 0)
+                msleep(ulong(wait));
+        }
+        frameClock.start();
+        const QSize pixels = m_size * m_device_pixel_ratio;
+        context.functions()->glViewport(0, 0, pixels.width(), pixels.height());
+        QOpenGLPaintDevice device(pixels);
+        device.setDevicePixelRatio(m_device_pixel_ratio);
+        m_scene.renderFrame(&device, m_size.width(), m_size.height(), m_device_pixel_ratio);
+        context.swapBuffers(m_window);
+    }
+
+    if (initialized && context.makeCurrent(m_window)) {
+        m_scene.cleanup();
+        context.doneCurrent();
+    }
+}
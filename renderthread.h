@@ -0,0 +1,89 @@
+#ifndef RENDERTHREAD_H
+#define RENDERTHREAD_H
+
+#include <QAtomicInt>
+#include <QFuture>
+#include <QSemaphore>
+#include <QSize>
+#include <QThread>
+
+#include "scenedriver.h"
+#include "spscqueue.h"
+
+class QWindow;
+
+// Renders into a window from a thread of its own, with its own GL context, so a busy GUI
+// thread (modal dialogs, layout, slow event handlers) doesn't hold frames back. The scene,
+// camera and simulation live on the render thread; the GUI thread only posts commands
+// (input, surface changes, meshes to load) through a lock-free queue. Swaps wait for
+// vblank and pace the loop; with nothing to animate it sleeps until the next post.
+class RenderThread : public QThread
+{
+    Q_OBJECT
+
+public:
+    explicit RenderThread(QWindow *window);
+    ~RenderThread() override;
+
+    // GUI thread, applied on the render thread before its next frame
+    void postInput(const InputEvent &input);
+    void postSurface(const QSize &size, qreal devicePixelRatio, bool exposed);
+    void postMesh(Renderer::MeshKind kind, const QString &path);
+    // Asks run() to finish and waits for it. The GL resources are freed on the render thread
+    void stop();
+
+    // The render thread's rotation mode, readable from any thread
+    bool autoRotate() const { return m_auto_rotate.loadAcquire() != 0; }
+
+    // Setup, only before start()
+    SceneDriver &scene() { return m_scene; }
+    void setFrameRateCap(int fps) { m_fps_cap = qMax(0, fps); }
+
+signals:
+    // Emitted on the render thread, so connections to GUI objects are queued
+    void rotationTypeChanged();
+
+protected:
+    void run() override;
+
+private:
+    struct Command
+    {
+        enum Type { Input, Surface, Mesh };
+
+        Type type;
+        InputEvent input;
+        QSize size;
+        qreal devicePixelRatio;
+        bool exposed;
+        int kind;
+        QString path;
+
+        Command(Type type = Input) : type(type), devicePixelRatio(1.0), exposed(false), kind(0) {}
+    };
+    // Enough for far more input than arrives in a frame
+    enum { QueueSize = 1024, IdleWaitMs = 50 };
+
+    QWindow *m_window;
+    SpscQueue<Command, QueueSize> m_commands;
+    QSemaphore m_wake; // released on every post, the idle loop sleeps on it
+    QAtomicInt m_auto_rotate;
+    int m_fps_cap;
+
+    // Render thread only, once it runs
+    SceneDriver m_scene;
+    QSize m_size;
+    qreal m_device_pixel_ratio;
+    bool m_exposed;
+    QFuture<MeshData> m_mesh_jobs[Renderer::MeshKindCount];
+    bool m_mesh_pending[Renderer::MeshKindCount];
+
+    void post(const Command &command);
+    // Applies everything posted so far, true if a frame is due for it. Mesh loads aren't,
+    // meshesLoaded() is once they finish
+    bool processCommands();
+    bool meshesLoaded() const;
+    void uploadMeshes();
+};
+
+#endif // RENDERTHREAD_H
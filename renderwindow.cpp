@@ -0,0 +1,101 @@
+#include "renderwindow.h"
+
+#include <QKeyEvent>
+#include <QMouseEvent>
+#include <QWheelEvent>
+
+RenderWindow::RenderWindow(QWindow *parent) : QWindow(parent), m_thread(this)
+{
+    setSurfaceType(QWindow::OpenGLSurface);
+    QSurfaceFormat format = QSurfaceFormat::defaultFormat();
+    format.setVersion(3, 3);
+    format.setProfile(QSurfaceFormat::CoreProfile);
+    format.setDepthBufferSize(24);
+    setFormat(format);
+    connect(&m_thread, SIGNAL(rotationTypeChanged()), this, SIGNAL(rotationTypeChanged()));
+}
+RenderWindow::~RenderWindow()
+{
+    // While the native window still exists, the thread makes it current one last time
+    m_thread.stop();
+}
+
+void RenderWindow::loadMesh(Renderer::MeshKind kind, const QString &path)
+{
+    m_thread.postMesh(kind, path);
+}
+bool RenderWindow::startRecording(const QString &path)
+{
+    Q_ASSERT(!m_thread.isRunning());
+    return m_thread.scene().startRecording(path);
+}
+bool RenderWindow::startReplay(const QString &path)
+{
+    Q_ASSERT(!m_thread.isRunning());
+    return m_thread.scene().startReplay(path);
+}
+void RenderWindow::setCaptureTarget(const QString &directory, FrameCapture::Format format)
+{
+    Q_ASSERT(!m_thread.isRunning());
+    m_thread.scene().setCaptureTarget(directory, format);
+}
+void RenderWindow::setCapturing(bool enabled)
+{
+    Q_ASSERT(!m_thread.isRunning());
+    m_thread.scene().setCapturing(enabled);
+}
+void RenderWindow::setFrameRateCap(int fps)
+{
+    Q_ASSERT(!m_thread.isRunning());
+    m_thread.setFrameRateCap(fps);
+}
+void RenderWindow::setRotationType()
+{
+    m_thread.postInput(InputEvent(InputEvent::RotationType));
+}
+
+void RenderWindow::postSurface()
+{
+    m_thread.postSurface(size(), devicePixelRatio(), isExposed());
+}
+void RenderWindow::exposeEvent(QExposeEvent *)
+{
+    postSurface();
+    // Started once, on the first expose, when the native window is there to render into
+    if (isExposed() && !m_thread.isRunning() && !m_thread.isFinished())
+        m_thread.start();
+}
+void RenderWindow::resizeEvent(QResizeEvent *)
+{
+    postSurface();
+}
+
+void RenderWindow::keyPressEvent(QKeyEvent *event)
+{
+    InputEvent input(InputEvent::Key);
+    input.key = event->key();
+    input.text = event->text();
+    m_thread.postInput(input);
+}
+void RenderWindow::mousePressEvent(QMouseEvent *event)
+{
+    InputEvent input(InputEvent::MousePress);
+    input.x = event->x();
+    input.y = event->y();
+    m_thread.postInput(input);
+}
+void RenderWindow::mouseMoveEvent(QMouseEvent *event)
+{
+    InputEvent input(InputEvent::MouseMove);
+    input.x = event->x();
+    input.y = event->y();
+    input.buttons = int(event->buttons());
+    m_thread.postInput(input);
+}
+void RenderWindow::wheelEvent(QWheelEvent *event)
+{
+    InputEvent input(InputEvent::Wheel);
+    input.x = event->angleDelta().x();
+    input.y = event->angleDelta().y();
+    m_thread.postInput(input);
+}
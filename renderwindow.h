@@ -0,0 +1,48 @@
+#ifndef RENDERWINDOW_H
+#define RENDERWINDOW_H
+
+#include <QWindow>
+
+#include "renderthread.h"
+
+// The view of GLWidget with its frames drawn on a RenderThread. Events are turned into
+// input on the GUI thread and posted, nothing here waits for the render thread. Embed it
+// with QWidget::createWindowContainer()
+class RenderWindow : public QWindow
+{
+    Q_OBJECT
+
+public:
+    explicit RenderWindow(QWindow *parent = nullptr);
+    ~RenderWindow() override;
+
+    void keyPressEvent(QKeyEvent *event) override; // public like GLWidget's, Window forwards keys
+    bool autoRotate() const { return m_thread.autoRotate(); }
+    void loadMesh(Renderer::MeshKind kind, const QString &path);
+
+    // Setup before the window is first shown, see SceneDriver
+    bool startRecording(const QString &path);
+    bool startReplay(const QString &path);
+    void setCaptureTarget(const QString &directory, FrameCapture::Format format);
+    void setCapturing(bool enabled);
+    void setFrameRateCap(int fps); // 0 - no cap, vsync only
+
+signals:
+    void rotationTypeChanged();
+
+public slots:
+    void setRotationType();
+
+protected:
+    void exposeEvent(QExposeEvent *event) override;
+    void resizeEvent(QResizeEvent *event) override;
+    void mousePressEvent(QMouseEvent *event) override;
+    void mouseMoveEvent(QMouseEvent *event) override;
+    void wheelEvent(QWheelEvent *event) override;
+
+private:
+    RenderThread m_thread;
+    void postSurface();
+};
+
+#endif // RENDERWINDOW_H
@@ -0,0 +1,328 @@
+#include "scenedriver.h"
+
+#include <QPainter>
+#include <QStringList>
+
+SceneDriver::SceneDriver() : camera_up(0.0f, 1.0f, 0.0f), camera_front(0.0f, 0.0f, -1.0f)
+{
+    m_autoRotate = true;
+    m_showHud = false;
+    m_xRot = m_yRot = m_zRot = 0;
+    t_x = t_y = t_z = 0;
+    m_replay_frames = 0;
+    m_capture_directory = "capture";
+    m_capture_format = FrameCapture::Png;
+    m_capture_wanted = false;
+}
+SceneDriver::~SceneDriver()
+{
+    m_input.stop(m_clock.tick());
+}
+
+void SceneDriver::initialize()
+{
+    m_renderer.initialize();
+    m_capture.initialize();
+}
+void SceneDriver::cleanup()
+{
+    m_capture.cleanup();
+    m_renderer.cleanup();
+}
+
+bool SceneDriver::animating() const
+{
+    return m_autoRotate || m_renderer.loading() || m_input.replaying();
+}
+bool SceneDriver::applyKey(int key, const QString &text)
+{
+    // Every bound key moves the camera or flips a toggle, so only unbound keys change nothing
+    bool changed = false;
+    float cameraSpeed = 0.30f; // adjust accordingly
+    if (key == Qt::Key_W || text == "ц" || text == "Ц") {
+        camera_pos += cameraSpeed * camera_up;
+        changed = true;
+    }
+    if (key == Qt::Key_S || text == "ы" || text == "Ы") {
+        camera_pos -= cameraSpeed * camera_up;
+        changed = true;
+    }
+    if (key == Qt::Key_A || text == "ф" || text == "Ф") {
+        camera_pos -= QVector3D::crossProduct(camera_front, camera_up).normalized() * cameraSpeed;
+        changed = true;
+    }
+    if (key == Qt::Key_D || text == "в" || text == "В") {
+        camera_pos += QVector3D::crossProduct(camera_front, camera_up).normalized() * cameraSpeed;
+        changed = true;
+    }
+    if (key == Qt::Key_I || text == "ш" || text == "Ш") {
+        m_renderer.setInstanced(!m_renderer.instanced());
+        changed = true;
+    }
+    if (key == Qt::Key_O || text == "щ" || text == "Щ") {
+        m_renderer.setOcclusionCulling(!m_renderer.occlusionCulling());
+        changed = true;
+    }
+    if (key == Qt::Key_H || text == "р" || text == "Р") {
+        setHudVisible(!m_showHud);
+        changed = true;
+    }
+    if (key == Qt::Key_C || text == "с" || text == "С") {
+        setCapturing(!m_capture_wanted);
+        changed = true;
+    }
+    return changed;
+}
+
+bool SceneDriver::setXRotation(int angle)
+{
+    qNormalizeAngle(angle);
+    if (angle == m_xRot)
+        return false;
+    m_xRot = angle;
+    return true;
+}
+bool SceneDriver::setYRotation(int angle)
+{
+    qNormalizeAngle(angle);
+    if (angle == m_yRot)
+        return false;
+    m_yRot = angle;
+    return true;
+}
+bool SceneDriver::setZRotation(int angle)
+{
+    qNormalizeAngle(angle);
+    if (angle == m_zRot)
+        return false;
+    m_zRot = angle;
+    return true;
+}
+void SceneDriver::setCaptureTarget(const QString &directory, FrameCapture::Format format)
+{
+    m_capture_directory = directory;
+    m_capture_format = format;
+}
+
+bool SceneDriver::startRecording(const QString &path)
+{
+    return m_input.startRecording(path);
+}
+bool SceneDriver::startReplay(const QString &path)
+{
+    if (!m_input.startReplay(path))
+        return false;
+    // Input recorded before the first tick
+    InputEvent input;
+    while (m_input.next(m_clock.tick(), input))
+        applyInput(input);
+    m_replay_frames = 0;
+    m_replay_timer.start();
+    return true;
+}
+void SceneDriver::catchUp()
+{
+    for (int ticks = m_clock.pending(); ticks > 0; ticks--)
+        stepSimulation();
+}
+void SceneDriver::stepSimulation()
+{
+    m_clock.step();
+    if (m_autoRotate) {
+        t_x += RotationPerTick; t_y += RotationPerTick; t_z += RotationPerTick;
+        m_xRot = t_x; m_yRot = t_y; m_zRot = t_z;
+    }
+    else {
+        t_x = m_xRot; t_y = m_yRot; t_z = m_zRot;
+    }
+    if (!m_input.replaying())
+        return;
+    // Recorded input was applied after the rotation of its tick, so it is here too
+    InputEvent input;
+    while (m_input.next(m_clock.tick(), input))
+        applyInput(input);
+    if (m_input.finished(m_clock.tick())) {
+        const double ms = m_replay_timer.nsecsElapsed() / 1.0e6;
+        qInfo("Replay finished: %u ticks, %d frames in %.1f ms (%.3f ms per frame)",
+              m_clock.tick(), m_replay_frames, ms, m_replay_frames ? ms / m_replay_frames : 0.0);
+        m_input.stop(m_clock.tick());
+        m_clock.restart(); // live input takes over from here
+    }
+}
+bool SceneDriver::liveInput(InputEvent input)
+{
+    // While a replay runs it is the only input
+    if (m_input.replaying())
+        return false;
+    // Bring the simulation up to now, so the input lands at the tick it happened in
+    catchUp();
+    input.tick = m_clock.tick();
+    m_input.append(input);
+    return applyInput(input);
+}
+bool SceneDriver::applyInput(const InputEvent &input)
+{
+    bool changed = false;
+    switch (input.type) {
+    case InputEvent::Key:
+        changed = applyKey(input.key, input.text);
+        break;
+    case InputEvent::Wheel: {
+        QPoint numDegrees = QPoint(input.x, input.y) / 8;
+        float cameraSpeed = 0.30f;
+        QPoint numSteps = numDegrees / 15;
+        if (!numSteps.isNull()) {
+            QVector3D numSteps3D(numSteps.x(), 0, numSteps.y());
+            camera_pos += (-1.0f) * numSteps3D * cameraSpeed;
+            changed = true;
+        }
+        break;
+    }
+    case InputEvent::MousePress:
+        m_lastPos = QPoint(input.x, input.y);
+        break;
+    case InputEvent::MouseMove: {
+        if (m_autoRotate)
+            break;
+        int dx = input.x - m_lastPos.x();
+        int dy = input.y - m_lastPos.y();
+
+        if (input.buttons & Qt::LeftButton) {
+            changed |= setXRotation(m_xRot + 8 * dy);
+            changed |= setYRotation(m_yRot + 8 * dx);
+        }
+        else if (input.buttons & Qt::RightButton) {
+            changed |= setXRotation(m_xRot + 8 * dy);
+            changed |= setZRotation(m_zRot + 8 * dx);
+        }
+        m_lastPos = QPoint(input.x, input.y);
+        break;
+    }
+    case InputEvent::RotationType:
+        m_autoRotate = !m_autoRotate;
+        changed = true;
+        break;
+    }
+    return changed;
+}
+void SceneDriver::renderFrame(QPaintDevice *device, int width, int height, qreal devicePixelRatio)
+{
+    // Live the scene moves on by the ticks wall time allows, a replay by exactly one per
+    // frame, so every run of it renders the same frames
+    if (m_input.replaying()) {
+        m_replay_frames++;
+        stepSimulation();
+    }
+    else {
+        catchUp();
+    }
+
+    FrameState state;
+    state.cameraPos = camera_pos;
+    state.cameraFront = camera_front;
+    state.cameraUp = camera_up;
+    state.xRot = m_xRot;
+    state.yRot = m_yRot;
+    state.zRot = m_zRot;
+    m_frame_timer.start();
+    m_renderer.render(state, width, height);
+    // Before the HUD is drawn, so it doesn't end up in the frames
+    if (m_capture_wanted != m_capture.active()) {
+        if (!m_capture_wanted)
+            m_capture.stop();
+        else if (!m_capture.start(m_capture_directory, m_capture_format))
+            m_capture_wanted = false;
+    }
+    m_capture.capture(qRound(width * devicePixelRatio), qRound(height * devicePixelRatio));
+    double frameCpuMs = m_frame_timer.nsecsElapsed() / 1.0e6;
+
+    if (m_showHud)
+        drawHud(device, width, height, frameCpuMs);
+}
+void SceneDriver::drawHud(QPaintDevice *device, int width, int height, double frameCpuMs)
+{
+    QString text;
+    double gpuTotal = 0.0;
+    int drawCalls = 0;
+    int triangles = 0;
+    for (int i = 0; i < Renderer::MeshKindCount; i++) {
+        Renderer::MeshKind kind = Renderer::MeshKind(i);
+        const Renderer::GroupStats &stats = m_renderer.groupStats(kind);
+        QString gpu = stats.gpuMs < 0.0 ? QString("-") : QString::number(stats.gpuMs, 'f', 3);
+        text += QString("%1 gpu %2 ms  cpu %3 ms  draws %4  tris %5\n")
+                .arg(QString(Renderer::meshName(kind)), -10)
+                .arg(gpu, 6)
+                .arg(stats.cpuMs, 6, 'f', 3)
+                .arg(stats.drawCalls, 5)
+                .arg(stats.triangles, 7);
+        gpuTotal += qMax(stats.gpuMs, 0.0);
+        drawCalls += stats.drawCalls;
+        triangles += stats.triangles;
+    }
+    text += QString("%1 gpu %2 ms  cpu %3 ms  draws %4  tris %5\n")
+            .arg(QString("frame"), -10)
+            .arg(gpuTotal, 6, 'f', 3)
+            .arg(frameCpuMs, 6, 'f', 3)
+            .arg(drawCalls, 5)
+            .arg(triangles, 7);
+    const Renderer::CullStats &culling = m_renderer.cullStats();
+    text += QString("%1 visible %2 of %3  occluded %4%5  cpu %6 ms  sort %7 ms\n")
+            .arg(QString("culling"), -10)
+            .arg(culling.visible)
+            .arg(culling.objects)
+            .arg(culling.occluded)
+            .arg(m_renderer.occlusionCulling() ? "" : " (off)")
+            .arg(culling.cpuMs, 0, 'f', 3)
+            .arg(culling.queueMs, 0, 'f', 3);
+    const Renderer::LodStats &lod = m_renderer.lodStats();
+    QStringList levels;
+    for (int objects : lod.objects)
+        levels << QString::number(objects);
+    text += QString("%1 tris %2 of %3  bias %4  levels %5\n")
+            .arg(QString("lod"), -10)
+            .arg(lod.triangles)
+            .arg(m_renderer.triangleBudget())
+            .arg(lod.bias, 0, 'f', 2)
+            .arg(levels.join('/'));
+    const GlStateCache::Counters &binds = m_renderer.stateCounters();
+    text += QString("%1 %2 issued  %3 skipped\n")
+            .arg(QString("binds"), -10)
+            .arg(binds.issued)
+            .arg(binds.skipped);
+    const ProgramCache::Stats &programs = m_renderer.programCacheStats();
+    text += QString("%1 %2 cached (%3 ms)  %4 compiled (%5 ms)\n")
+            .arg(QString("programs"), -10)
+            .arg(programs.hits)
+            .arg(programs.loadMs, 0, 'f', 1)
+            .arg(programs.misses)
+            .arg(programs.compileMs, 0, 'f', 1);
+    text += QString("%1 %2 KiB  saved %3 KiB\n")
+            .arg(QString("geometry"), -10)
+            .arg(m_renderer.geometryBytes() / 1024.0, 0, 'f', 1)
+            .arg(m_renderer.geometryBytesSaved() / 1024.0, 0, 'f', 1);
+    text += QString("%1 %2 x %3 KiB  fence waits %4")
+            .arg(QString("instances"), -10)
+            .arg(int(StreamRing::Regions))
+            .arg(m_renderer.instanceRingBytes() / 1024.0, 0, 'f', 1)
+            .arg(m_renderer.instanceRingWaits());
+
+    if (m_capture.active()) {
+        const FrameCapture::Stats capture = m_capture.stats();
+        text += QString("\n%1 %2 frames  written %3  dropped %4  waits %5")
+                .arg(QString("capture"), -10)
+                .arg(capture.frames)
+                .arg(capture.written)
+                .arg(capture.dropped)
+                .arg(capture.waits);
+    }
+
+    QPainter painter(device);
+    QFont font("Monospace");
+    font.setStyleHint(QFont::TypeWriter);
+    font.setPointSize(9);
+    painter.setFont(font);
+    QRect box = painter.boundingRect(QRect(0, 0, width, height).adjusted(8, 8, -8, -8), Qt::AlignLeft | Qt::AlignTop, text);
+    painter.fillRect(box.adjusted(-4, -4, 4, 4), QColor(0, 0, 0, 160));
+    painter.setPen(Qt::white);
+    painter.drawText(box, Qt::AlignLeft | Qt::AlignTop, text);
+}
@@ -0,0 +1,101 @@
+#ifndef SCENEDRIVER_H
+#define SCENEDRIVER_H
+
+#include <QElapsedTimer>
+#include <QPoint>
+
+#include "framecapture.h"
+#include "inputlog.h"
+#include "renderer.h"
+#include "simulationclock.h"
+
+class QPaintDevice;
+
+// Everything a view of the scene runs per frame: the simulation clock, live, recorded or
+// replayed input, the camera, the renderer, frame capture and the HUD. GLWidget drives it
+// from paintGL on the GUI thread, RenderThread from a thread of its own. It is not
+// thread-safe, one thread at a time uses it, and everything from initialize() to cleanup()
+// needs the context current.
+class SceneDriver
+{
+public:
+    SceneDriver();
+    ~SceneDriver();
+
+    void initialize();
+    void cleanup();
+    // Moves the simulation on to now (a replay by one tick), renders into the bound
+    // framebuffer and paints the HUD on device if it's shown. Sizes are in logical pixels
+    void renderFrame(QPaintDevice *device, int width, int height, qreal devicePixelRatio);
+
+    // Input that just happened, applied at the current tick. Ignored while a replay runs.
+    // True if it changed what a frame shows: camera, rotation, its mode or a toggle
+    bool liveInput(InputEvent input);
+    // Input recording: start either before the first frame, a replay then goes through the
+    // same states tick by tick, at one tick per frame
+    bool startRecording(const QString &path);
+    bool startReplay(const QString &path);
+
+    // Frames are due without any input: rotating, loading meshes or textures, replaying
+    bool animating() const;
+    bool autoRotate() const { return m_autoRotate; }
+    // False if the normalized angle is the current one
+    bool setXRotation(int angle);
+    bool setYRotation(int angle);
+    bool setZRotation(int angle);
+    void setHudVisible(bool visible) { m_showHud = visible; }
+    bool hudVisible() const { return m_showHud; }
+    // Capture starts or stops at the next frame, where the context is current
+    void setCapturing(bool enabled) { m_capture_wanted = enabled; }
+    bool capturing() const { return m_capture_wanted; }
+    // Where setCapturing() saves frames, see FrameCapture
+    void setCaptureTarget(const QString &directory, FrameCapture::Format format);
+
+    Renderer &renderer() { return m_renderer; }
+    const Renderer &renderer() const { return m_renderer; }
+
+private:
+    bool m_autoRotate;
+
+    //For rotation using mouse
+    int m_xRot;
+    int m_yRot;
+    int m_zRot;
+    QPoint m_lastPos;
+
+    // Simulation: rotation moves RotationPerTick every tick of m_clock. All input goes through
+    // applyInput() at a tick, which is what makes m_input replays exact
+    enum { RotationPerTick = 30 };
+    SimulationClock m_clock;
+    InputLog m_input;
+    int m_replay_frames;
+    QElapsedTimer m_replay_timer;
+    void catchUp();
+    void stepSimulation();
+    bool applyInput(const InputEvent &input);
+    bool applyKey(int key, const QString &text);
+
+    Renderer m_renderer;
+
+    // Frame capture, started and stopped in renderFrame where the context is current
+    FrameCapture m_capture;
+    QString m_capture_directory;
+    FrameCapture::Format m_capture_format;
+    bool m_capture_wanted;
+
+    // Performance overlay
+    bool m_showHud;
+    QElapsedTimer m_frame_timer;
+    void drawHud(QPaintDevice *device, int width, int height, double frameCpuMs);
+
+    QVector3D camera_pos;
+    QVector3D camera_up;
+    QVector3D camera_front;
+
+    //Auto rotation angles
+    int t_x;
+    int t_y;
+    int t_z;
+};
+
+#endif // SCENEDRIVER_H
@@ -0,0 +1,22 @@
+#include "simulationclock.h"
+
+static const qint64 TickNs = 1000000000 / SimulationClock::TicksPerSecond;
+
+SimulationClock::SimulationClock()
+{
+    m_tick = 0;
+    restart();
+}
+
+void SimulationClock::restart()
+{
+    m_timer.start();
+    m_consumed_ns = 0;
+}
+int SimulationClock::pending()
+{
+    const qint64 ticks = (m_timer.nsecsElapsed() - m_consumed_ns) / TickNs;
+    m_consumed_ns += ticks * TickNs;
+    // Ticks past the limit are dropped, not postponed
+    return int(qMin<qint64>(ticks, TicksPerSecond));
+}
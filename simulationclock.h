@@ -0,0 +1,31 @@
+#ifndef SIMULATIONCLOCK_H
+#define SIMULATIONCLOCK_H
+
+#include <QElapsedTimer>
+
+// Fixed-step simulation time on a monotonic clock. The scene moves in whole ticks of
+// 1 / TicksPerSecond s, so how far it gets doesn't depend on the frame rate; the part of a
+// tick left over carries into the next pending().
+class SimulationClock
+{
+public:
+    enum { TicksPerSecond = 60 };
+
+    SimulationClock();
+
+    // Forgets the wall time that passed so far, e.g. after a replay
+    void restart();
+    // Whole ticks that passed on the wall clock since the last call, at most a second's worth
+    // so a stall (a debugger, a suspended laptop) doesn't turn into a burst
+    int pending();
+    // Simulation time is only moved on by the caller, one tick at a time
+    quint32 step() { return ++m_tick; }
+    quint32 tick() const { return m_tick; }
+
+private:
+    QElapsedTimer m_timer;
+    qint64 m_consumed_ns;
+    quint32 m_tick;
+};
+
+#endif // SIMULATIONCLOCK_H
@@ -0,0 +1,47 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <QAtomicInt>
+
+// Bounded single producer, single consumer queue without locks. One thread pushes, one other
+// thread pops; each side writes only its own index and publishes it with a release store
+// after touching the slot, the other side reads it with an acquire load. One slot always
+// stays empty to tell a full queue from an empty one, so it holds Capacity - 1 items.
+template <typename T, int Capacity>
+class SpscQueue
+{
+public:
+    SpscQueue() : m_head(0), m_tail(0) {}
+
+    // Producer thread. False if the queue is full, the value is not queued then
+    bool push(const T &value)
+    {
+        const int tail = m_tail.loadAcquire();
+        const int next = (tail + 1) % Capacity;
+        if (next == m_head.loadAcquire())
+            return false;
+        m_items[tail] = value;
+        m_tail.storeRelease(next);
+        return true;
+    }
+    // Consumer thread. False if the queue is empty
+    bool pop(T &value)
+    {
+        const int head = m_head.loadAcquire();
+        if (head == m_tail.loadAcquire())
+            return false;
+        value = m_items[head];
+        m_items[head] = T(); // release what the item holds now, not when the slot is reused
+        m_head.storeRelease((head + 1) % Capacity);
+        return true;
+    }
+
+private:
+    // The items sit between the indices so the two threads, which write one index each,
+    // don't share a cache line
+    QAtomicInt m_head;
+    T m_items[Capacity];
+    QAtomicInt m_tail;
+};
+
+#endif // SPSCQUEUE_H
@@ -0,0 +1,82 @@
+#include "streamring.h"
+
+#include <QElapsedTimer>
+
+StreamRing::StreamRing()
+{
+    m_buffer = 0;
+    m_region = 0;
+    m_current = 0;
+    for (GLsync &fence : m_fences)
+        fence = nullptr;
+    m_waits = 0;
+    m_wait_ms = 0.0;
+}
+
+void StreamRing::initialize(qint64 regionBytes)
+{
+    initializeOpenGLFunctions();
+    glGenBuffers(1, &m_buffer);
+    allocate(regionBytes);
+}
+void StreamRing::cleanup()
+{
+    for (GLsync &fence : m_fences) {
+        if (fence)
+            glDeleteSync(fence);
+        fence = nullptr;
+    }
+    glDeleteBuffers(1, &m_buffer);
+    m_buffer = 0;
+    m_region = 0;
+}
+void StreamRing::allocate(qint64 regionBytes)
+{
+    // New storage, nothing the GPU still reads can be in it
+    for (GLsync &fence : m_fences) {
+        if (fence)
+            glDeleteSync(fence);
+        fence = nullptr;
+    }
+    // Keep regions aligned for any attribute or uniform block offset
+    m_region = (qMax<qint64>(regionBytes, 256) + 255) & ~qint64(255);
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+    glBufferData(GL_ARRAY_BUFFER, m_region * Regions, nullptr, GL_STREAM_DRAW);
+}
+
+void *StreamRing::map(qint64 bytes)
+{
+    m_current = (m_current + 1) % Regions;
+    if (bytes > m_region)
+        allocate(qMax(bytes, 2 * m_region));
+
+    GLsync &fence = m_fences[m_current];
+    if (fence) {
+        if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED) {
+            QElapsedTimer timer;
+            timer.start();
+            m_waits++;
+            while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 100000000) == GL_TIMEOUT_EXPIRED) {}
+            m_wait_ms += timer.nsecsElapsed() / 1.0e6;
+        }
+        glDeleteSync(fence);
+        fence = nullptr;
+    }
+
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+    if (bytes <= 0)
+        return nullptr;
+    return glMapBufferRange(GL_ARRAY_BUFFER, offset(), bytes,
+                            GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+}
+bool StreamRing::unmap()
+{
+    glBindBuffer(GL_ARRAY_BUFFER, m_buffer);
+    return glUnmapBuffer(GL_ARRAY_BUFFER) == GL_TRUE;
+}
+void StreamRing::fence()
+{
+    if (m_fences[m_current])
+        glDeleteSync(m_fences[m_current]);
+    m_fences[m_current] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
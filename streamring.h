@@ -0,0 +1,49 @@
+#ifndef STREAMRING_H
+#define STREAMRING_H
+
+#include <QOpenGLFunctions_3_3_Core>
+
+// Buffer for data rewritten every frame, split into Regions regions used in turn. A region is
+// mapped with GL_MAP_UNSYNCHRONIZED_BIT, so the driver neither waits nor copies; instead
+// fence() marks the end of the draws that read it, and map() waits on that fence when the
+// region comes around again, which with three regions is normally long signalled.
+// GL 3.3 has no persistent mapping, so each frame maps and unmaps its region.
+class StreamRing : protected QOpenGLFunctions_3_3_Core
+{
+public:
+    enum { Regions = 3 };
+
+    StreamRing();
+
+    // All of these need a current GL 3.3 context
+    void initialize(qint64 regionBytes);
+    void cleanup();
+    // Moves to the next region, growing all regions if bytes don't fit, and maps it. The
+    // buffer stays bound to GL_ARRAY_BUFFER. Returns nullptr for 0 bytes or if the driver
+    // can't map it
+    void *map(qint64 bytes);
+    // False if the contents were lost and have to be written again
+    bool unmap();
+    // Call after the draws that read the current region
+    void fence();
+
+    GLuint buffer() const { return m_buffer; }
+    // Start of the current region in buffer()
+    qintptr offset() const { return qintptr(m_current) * m_region; }
+    qint64 regionBytes() const { return m_region; }
+    // How often map() found its region still in use by the GPU, and how long it waited
+    int waits() const { return m_waits; }
+    double waitMs() const { return m_wait_ms; }
+
+private:
+    GLuint m_buffer;
+    qint64 m_region;
+    int m_current;
+    GLsync m_fences[Regions];
+    int m_waits;
+    double m_wait_ms;
+
+    void allocate(qint64 regionBytes);
+};
+
+#endif // STREAMRING_H
@@ -0,0 +1,318 @@
+#include "texturecache.h"
+
+#include <QCryptographicHash>
+#include <QDir>
+#include <QFileInfo>
+#include <QImage>
+#include <QSaveFile>
+#include <QStandardPaths>
+#include <climits>
+#include <cstring>
+
+namespace {
+
+const char textureMagic[8] = { 'L', 'W', '2', 'T', 'E', 'X', '\0', '\0' };
+
+enum {
+    TextureFileVersion = 1,
+    BlobAlignment = 64,
+    MaxLevels = 32
+};
+
+struct TextureFileHeader
+{
+    char magic[8];
+    quint32 version;
+    quint32 format; // 0 = RGB8, 1 = DXT1
+    quint32 levelCount;
+    quint32 reserved;
+};
+
+struct TextureFileLevel
+{
+    quint32 width;
+    quint32 height;
+    quint64 offset;
+    quint64 size;
+};
+
+}
+
+static quint64 alignUp(quint64 value)
+{
+    return (value + BlobAlignment - 1) / BlobAlignment * BlobAlignment;
+}
+
+static bool fail(QString *error, const QString &message)
+{
+    if (error)
+        *error = message;
+    return false;
+}
+
+// RGB8 rows are padded to 4 bytes, as GL_UNPACK_ALIGNMENT expects by default
+static int rowPitch(int width)
+{
+    return (width * 3 + 3) & ~3;
+}
+
+static qint64 levelSize(int width, int height, bool compressed)
+{
+    if (compressed)
+        return qint64((width + 3) / 4) * ((height + 3) / 4) * 8;
+    return qint64(rowPitch(width)) * height;
+}
+
+// 2x2 box filter, odd edges reuse the last row or column
+static void downsample(const uchar *src, int width, int height, uchar *dst, int dstWidth, int dstHeight)
+{
+    const int srcPitch = rowPitch(width);
+    const int dstPitch = rowPitch(dstWidth);
+    for (int y = 0; y < dstHeight; y++) {
+        const uchar *row0 = src + qMin(2 * y, height - 1) * srcPitch;
+        const uchar *row1 = src + qMin(2 * y + 1, height - 1) * srcPitch;
+        uchar *out = dst + y * dstPitch;
+        for (int x = 0; x < dstWidth; x++) {
+            int x0 = qMin(2 * x, width - 1) * 3;
+            int x1 = qMin(2 * x + 1, width - 1) * 3;
+            for (int c = 0; c < 3; c++)
+                out[x * 3 + c] = uchar((row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4);
+        }
+    }
+}
+
+static quint16 pack565(const int rgb[3])
+{
+    return quint16((rgb[0] * 31 + 127) / 255 << 11 | (rgb[1] * 63 + 127) / 255 << 5 | (rgb[2] * 31 + 127) / 255);
+}
+
+static void unpack565(quint16 color, int rgb[3])
+{
+    int r = color >> 11 & 31, g = color >> 5 & 63, b = color & 31;
+    rgb[0] = r << 3 | r >> 2;
+    rgb[1] = g << 2 | g >> 4;
+    rgb[2] = b << 3 | b >> 2;
+}
+
+// Bounding box DXT1 encoder: quick, and good enough for photos of crates and walls
+static void compressBlock(const uchar pixels[16][3], uchar *out)
+{
+    int lo[3] = { 255, 255, 255 }, hi[3] = { 0, 0, 0 };
+    for (int i = 0; i < 16; i++) {
+        for (int c = 0; c < 3; c++) {
+            lo[c] = qMin(lo[c], int(pixels[i][c]));
+            hi[c] = qMax(hi[c], int(pixels[i][c]));
+        }
+    }
+    // Insetting the box a little lowers the error of the interpolated colors
+    for (int c = 0; c < 3; c++) {
+        int inset = (hi[c] - lo[c]) / 16;
+        lo[c] += inset;
+        hi[c] -= inset;
+    }
+    quint16 color0 = pack565(hi), color1 = pack565(lo);
+    quint32 indices = 0;
+    if (color0 != color1) {
+        // color0 > color1 selects the four color mode
+        if (color0 < color1)
+            qSwap(color0, color1);
+        int palette[4][3];
+        unpack565(color0, palette[0]);
+        unpack565(color1, palette[1]);
+        for (int c = 0; c < 3; c++) {
+            palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+            palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+        }
+        for (int i = 0; i < 16; i++) {
+            int best = 0, bestDistance = INT_MAX;
+            for (int p = 0; p < 4; p++) {
+                int distance = 0;
+                for (int c = 0; c < 3; c++) {
+                    int d = pixels[i][c] - palette[p][c];
+                    distance += d * d;
+                }
+                if (distance < bestDistance) {
+                    best = p;
+                    bestDistance = distance;
+                }
+            }
+            indices |= quint32(best) << (2 * i);
+        }
+    }
+    out[0] = uchar(color0);
+    out[1] = uchar(color0 >> 8);
+    out[2] = uchar(color1);
+    out[3] = uchar(color1 >> 8);
+    for (int i = 0; i < 4; i++)
+        out[4 + i] = uchar(indices >> (8 * i));
+}
+
+static void compressLevel(const uchar *src, int width, int height, uchar *dst)
+{
+    const int pitch = rowPitch(width);
+    uchar block[16][3];
+    for (int by = 0; by < height; by += 4) {
+        for (int bx = 0; bx < width; bx += 4) {
+            // Blocks hanging over the edge repeat the last pixels
+            for (int i = 0; i < 16; i++) {
+                const uchar *pixel = src + qMin(by + i / 4, height - 1) * pitch + qMin(bx + i % 4, width - 1) * 3;
+                memcpy(block[i], pixel, 3);
+            }
+            compressBlock(block, dst);
+            dst += 8;
+        }
+    }
+}
+
+// Lays out the whole cache file in memory: header, level table and 64-byte aligned levels
+static QByteArray buildTextureFile(const QImage &image, bool compress)
+{
+    QVector<TextureFileLevel> levels;
+    int width = image.width(), height = image.height();
+    quint64 offset = alignUp(sizeof(TextureFileHeader) + MaxLevels * sizeof(TextureFileLevel));
+    for (;;) {
+        TextureFileLevel level = { quint32(width), quint32(height), offset, quint64(levelSize(width, height, compress)) };
+        levels.append(level);
+        offset = alignUp(offset + level.size);
+        if (width == 1 && height == 1)
+            break;
+        width = qMax(1, width / 2);
+        height = qMax(1, height / 2);
+    }
+
+    QByteArray file(int(offset), '\0');
+    uchar *data = reinterpret_cast<uchar *>(file.data());
+    TextureFileHeader header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, textureMagic, sizeof(textureMagic));
+    header.version = TextureFileVersion;
+    header.format = compress ? 1 : 0;
+    header.levelCount = quint32(levels.size());
+    memcpy(data, &header, sizeof(header));
+    memcpy(data + sizeof(header), levels.constData(), levels.size() * sizeof(TextureFileLevel));
+
+    // The RGB chain is filtered level by level, each from the previous one
+    QVector<QByteArray> chain(levels.size());
+    chain[0] = QByteArray(int(levelSize(image.width(), image.height(), false)), '\0');
+    for (int y = 0; y < image.height(); y++)
+        memcpy(chain[0].data() + y * rowPitch(image.width()), image.constScanLine(y), size_t(image.width() * 3));
+    for (int i = 1; i < levels.size(); i++) {
+        chain[i] = QByteArray(int(levelSize(int(levels[i].width), int(levels[i].height), false)), '\0');
+        downsample(reinterpret_cast<const uchar *>(chain[i - 1].constData()), int(levels[i - 1].width), int(levels[i - 1].height),
+                   reinterpret_cast<uchar *>(chain[i].data()), int(levels[i].width), int(levels[i].height));
+    }
+    for (int i = 0; i < levels.size(); i++) {
+        const uchar *pixels = reinterpret_cast<const uchar *>(chain[i].constData());
+        if (compress)
+            compressLevel(pixels, int(levels[i].width), int(levels[i].height), data + levels[i].offset);
+        else
+            memcpy(data + levels[i].offset, pixels, size_t(levels[i].size));
+        chain[i] = QByteArray();
+    }
+    return file;
+}
+
+TextureData::TextureData()
+{
+    m_bits = nullptr;
+    m_compressed = false;
+}
+
+bool TextureData::map(const QString &path, QString *error)
+{
+    m_file.setFileName(path);
+    if (!m_file.open(QIODevice::ReadOnly))
+        return fail(error, m_file.errorString());
+    const uchar *data = m_file.map(0, m_file.size());
+    if (!data)
+        return fail(error, m_file.errorString());
+    return parse(data, m_file.size(), error);
+}
+
+bool TextureData::adopt(const QByteArray &file, QString *error)
+{
+    m_memory = file;
+    return parse(reinterpret_cast<const uchar *>(m_memory.constData()), m_memory.size(), error);
+}
+
+bool TextureData::parse(const uchar *data, qint64 size, QString *error)
+{
+    if (quint64(size) < sizeof(TextureFileHeader) + MaxLevels * sizeof(TextureFileLevel))
+        return fail(error, "truncated header");
+    TextureFileHeader header;
+    memcpy(&header, data, sizeof(header));
+    if (memcmp(header.magic, textureMagic, sizeof(textureMagic)) != 0 || header.version != TextureFileVersion)
+        return fail(error, "not a texture cache file or an old version");
+    if (header.format > 1 || !header.levelCount || header.levelCount > MaxLevels)
+        return fail(error, "corrupt header");
+
+    m_compressed = header.format == 1;
+    m_levels.resize(int(header.levelCount));
+    for (quint32 i = 0; i < header.levelCount; i++) {
+        TextureFileLevel stored;
+        memcpy(&stored, data + sizeof(TextureFileHeader) + i * sizeof(TextureFileLevel), sizeof(stored));
+        if (!stored.width || !stored.height || stored.width > 65536 || stored.height > 65536
+                || stored.size != quint64(levelSize(int(stored.width), int(stored.height), m_compressed))
+                || stored.offset > quint64(size) || stored.size > quint64(size) - stored.offset)
+            return fail(error, "corrupt level table");
+        TextureLevel &level = m_levels[int(i)];
+        level.width = int(stored.width);
+        level.height = int(stored.height);
+        level.offset = qint64(stored.offset);
+        level.size = qint64(stored.size);
+    }
+    m_bits = data;
+    return true;
+}
+
+QString TextureCache::cachePath(const QByteArray &source, bool mirror, bool compress, int size)
+{
+    QCryptographicHash hash(QCryptographicHash::Sha1);
+    hash.addData(source);
+    hash.addData(mirror ? "m" : "-");
+    hash.addData(compress ? "c" : "-");
+    hash.addData(QByteArray::number(size));
+    return QStandardPaths::writableLocation(QStandardPaths::CacheLocation)
+            + "/textures/" + QString::fromLatin1(hash.result().toHex()) + ".lw2tex";
+}
+
+QSharedPointer<TextureData> TextureCache::load(const QString &path, bool mirror, bool compress, int size)
+{
+    QSharedPointer<TextureData> texture(new TextureData);
+    QFile source(path);
+    if (!source.open(QIODevice::ReadOnly)) {
+        texture->error = source.errorString();
+        return texture;
+    }
+    // Hashing the encoded file is far cheaper than decoding it and works for resources too
+    const QByteArray encoded = source.readAll();
+    const QString cached = cachePath(encoded, mirror, compress, size);
+    QString error;
+    if (QFile::exists(cached)) {
+        if (texture->map(cached, &error))
+            return texture;
+        qWarning("Texture cache: %s: %s", qPrintable(cached), qPrintable(error));
+        texture.reset(new TextureData);
+    }
+
+    QImage image = QImage::fromData(encoded);
+    if (image.isNull()) {
+        texture->error = "can't decode the image";
+        return texture;
+    }
+    if (size > 0 && image.size() != QSize(size, size))
+        image = image.scaled(size, size, Qt::IgnoreAspectRatio, Qt::SmoothTransformation);
+    image = image.convertToFormat(QImage::Format_RGB888);
+    if (mirror)
+        image = image.mirrored(false, true);
+    const QByteArray file = buildTextureFile(image, compress);
+
+    QDir().mkpath(QFileInfo(cached).absolutePath());
+    // QSaveFile renames on commit, so readers never map a half-written file
+    QSaveFile out(cached);
+    if (!out.open(QIODevice::WriteOnly) || out.write(file) != file.size() || !out.commit())
+        qWarning("Texture cache: %s: %s", qPrintable(cached), qPrintable(out.errorString()));
+    if (!texture->adopt(file, &error))
+        texture->error = error;
+    return texture;
+}
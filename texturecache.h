@@ -0,0 +1,63 @@
+#ifndef TEXTURECACHE_H
+#define TEXTURECACHE_H
+
+#include <QFile>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QSharedPointer>
+#include <QVector>
+
+#ifndef GL_COMPRESSED_RGB_S3TC_DXT1_EXT
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT 0x83F0
+#endif
+
+// One mip level, offset and size are relative to TextureData::bits()
+struct TextureLevel
+{
+    int width;
+    int height;
+    qint64 offset;
+    qint64 size;
+};
+
+// Texture with its whole mip chain, either RGB8 with 4-byte aligned rows or DXT1 blocks.
+// The pixels are kept in memory right after a cache miss and mapped from the cache file
+// otherwise; the streamer copies them into a PBO level by level.
+class TextureData
+{
+public:
+    TextureData();
+
+    bool map(const QString &path, QString *error = nullptr);
+    bool adopt(const QByteArray &file, QString *error = nullptr);
+
+    bool compressed() const { return m_compressed; }
+    const QVector<TextureLevel> &levels() const { return m_levels; }
+    const uchar *bits() const { return m_bits; }
+
+    QString error; // set when the source couldn't be loaded
+
+private:
+    bool parse(const uchar *data, qint64 size, QString *error);
+
+    QFile m_file; // the mapping lives as long as the file object
+    QByteArray m_memory;
+    const uchar *m_bits;
+    QVector<TextureLevel> m_levels;
+    bool m_compressed;
+
+    Q_DISABLE_COPY(TextureData)
+};
+
+// Processed textures kept in the user cache directory, keyed by a hash of the source file
+// contents and the processing options. A miss decodes the image, resamples it to size x size
+// (0 - keep the original size), builds the mip chain on the CPU, optionally compresses it to
+// DXT1 and stores the result for the next launch.
+// Reentrant, meant to be called from worker threads.
+class TextureCache
+{
+public:
+    static QString cachePath(const QByteArray &source, bool mirror, bool compress, int size);
+    static QSharedPointer<TextureData> load(const QString &path, bool mirror, bool compress, int size);
+};
+
+#endif // TEXTURECACHE_H
@@ -0,0 +1,203 @@
+#include "texturestreamer.h"
+
+#include <QOpenGLContext>
+#include <QtConcurrent/QtConcurrentRun>
+#include <cstring>
+#include <limits>
+
+TextureStreamer::TextureStreamer()
+{
+    m_placeholder = 0;
+    m_array = 0;
+    m_staging = 0;
+    m_staging_compressed = false;
+    m_budget = 2 * 1024 * 1024;
+    m_layer_size = 512;
+    m_compression = true;
+    m_s3tc = false;
+    m_initialized = false;
+}
+
+void TextureStreamer::initialize()
+{
+    initializeOpenGLFunctions();
+    m_s3tc = QOpenGLContext::currentContext()->hasExtension(QByteArrayLiteral("GL_EXT_texture_compression_s3tc"));
+
+    // Layer lookups are clamped, so one layer stands in for any number of them
+    const GLubyte grey[4] = { 200, 200, 200, 255 };
+    glGenTextures(1, &m_placeholder);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_placeholder);
+    glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA, 1, 1, 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, grey);
+    // A single level, the default minification filter would make it incomplete otherwise
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, 0);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+    m_initialized = true;
+}
+
+void TextureStreamer::cleanup()
+{
+    if (!m_initialized)
+        return;
+    m_initialized = false;
+    for (Entry &entry : m_entries)
+        glDeleteBuffers(1, &entry.pbo);
+    m_entries.clear(); // decoding still in flight finishes on its own
+    glDeleteTextures(1, &m_array);
+    glDeleteTextures(1, &m_staging);
+    glDeleteTextures(1, &m_placeholder);
+    m_array = m_staging = m_placeholder = 0;
+    m_levels.clear();
+}
+
+int TextureStreamer::load(const QString &path, bool mirror)
+{
+    if (m_staging || m_array)
+        qWarning("TextureStreamer: %s is loaded after the array was allocated", qPrintable(path));
+    Entry entry;
+    entry.path = path;
+    entry.future = QtConcurrent::run(&TextureCache::load, path, mirror, m_compression && m_s3tc, m_layer_size);
+    entry.pbo = 0;
+    entry.level = entry.nextUnit = 0;
+    entry.done = false;
+    m_entries.append(entry);
+    return m_entries.size() - 1;
+}
+
+bool TextureStreamer::busy() const
+{
+    for (const Entry &entry : m_entries)
+        if (!entry.done)
+            return true;
+    return false;
+}
+
+void TextureStreamer::update()
+{
+    qint64 budget = m_budget;
+    for (int layer = 0; layer < m_entries.size() && budget > 0; layer++) {
+        const Entry &entry = m_entries[layer];
+        if (!entry.done && (entry.data || entry.future.isFinished()))
+            upload(layer, budget);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    publish();
+}
+
+void TextureStreamer::finish()
+{
+    qint64 budget = std::numeric_limits<qint64>::max();
+    for (int layer = 0; layer < m_entries.size(); layer++) {
+        if (m_entries[layer].done)
+            continue;
+        m_entries[layer].future.waitForFinished();
+        upload(layer, budget);
+    }
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+    publish();
+}
+
+void TextureStreamer::publish()
+{
+    if (!m_staging || busy())
+        return;
+    m_array = m_staging;
+    m_staging = 0;
+}
+
+bool TextureStreamer::allocate(const TextureData &data)
+{
+    if (m_staging || m_array) {
+        // Cached files of other sizes or formats have a different key, this is a safety net
+        return data.compressed() == m_staging_compressed && data.levels().size() == m_levels.size()
+                && data.levels()[0].width == m_levels[0].width && data.levels()[0].height == m_levels[0].height;
+    }
+    // The real array is filled off to the side, the placeholder stays bound until it's complete
+    m_levels = data.levels();
+    m_staging_compressed = data.compressed();
+    const GLsizei layers = m_entries.size();
+    glGenTextures(1, &m_staging);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_staging);
+    for (int i = 0; i < m_levels.size(); i++) {
+        if (m_staging_compressed)
+            glCompressedTexImage3D(GL_TEXTURE_2D_ARRAY, i, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, m_levels[i].width, m_levels[i].height,
+                                   layers, 0, GLsizei(m_levels[i].size * layers), nullptr);
+        else
+            glTexImage3D(GL_TEXTURE_2D_ARRAY, i, GL_RGB, m_levels[i].width, m_levels[i].height, layers,
+                         0, GL_RGB, GL_UNSIGNED_BYTE, nullptr);
+    }
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, m_levels.size() - 1);
+    return true;
+}
+
+void TextureStreamer::upload(int layer, qint64 &budget)
+{
+    Entry &entry = m_entries[layer];
+    if (!entry.data) {
+        entry.data = entry.future.result();
+        entry.future = QFuture<QSharedPointer<TextureData> >();
+        if (!entry.data->error.isEmpty() || !allocate(*entry.data)) {
+            qWarning("Can't load texture %s: %s", qPrintable(entry.path),
+                     qPrintable(entry.data->error.isEmpty() ? QString("size or format differs from the other layers") : entry.data->error));
+            entry.data.reset();
+            entry.done = true;
+            return;
+        }
+        // The PBO mirrors the file layout, so level offsets can be used as they are
+        const QVector<TextureLevel> &levels = entry.data->levels();
+        glGenBuffers(1, &entry.pbo);
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, entry.pbo);
+        glBufferData(GL_PIXEL_UNPACK_BUFFER, levels.last().offset + levels.last().size, nullptr, GL_STREAM_DRAW);
+    }
+
+    const QVector<TextureLevel> &levels = entry.data->levels();
+    const bool compressed = entry.data->compressed();
+    const int unitHeight = compressed ? 4 : 1;
+    glBindTexture(GL_TEXTURE_2D_ARRAY, m_staging);
+    while (budget > 0 && entry.level < levels.size()) {
+        const TextureLevel &level = levels[entry.level];
+        const int units = (level.height + unitHeight - 1) / unitHeight;
+        const qint64 unitBytes = level.size / units;
+        int count = int(qBound(qint64(1), budget / unitBytes, qint64(units - entry.nextUnit)));
+        qint64 offset = level.offset + qint64(entry.nextUnit) * unitBytes;
+        qint64 size = qint64(count) * unitBytes;
+        int y = entry.nextUnit * unitHeight;
+        int height = qMin(level.height - y, count * unitHeight);
+        const uchar *src = entry.data->bits() + offset;
+
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, entry.pbo);
+        // Every range is written once, so there is nothing to synchronize with
+        void *dst = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, offset, size,
+                                     GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+        const void *pixels = (void*)quintptr(offset);
+        if (dst) {
+            memcpy(dst, src, size_t(size));
+            glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+        }
+        else {
+            // Mapping failed, upload the slice from client memory instead
+            glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+            pixels = src;
+        }
+        if (compressed)
+            glCompressedTexSubImage3D(GL_TEXTURE_2D_ARRAY, entry.level, 0, y, layer, level.width, height, 1,
+                                      GL_COMPRESSED_RGB_S3TC_DXT1_EXT, GLsizei(size), pixels);
+        else
+            glTexSubImage3D(GL_TEXTURE_2D_ARRAY, entry.level, 0, y, layer, level.width, height, 1,
+                            GL_RGB, GL_UNSIGNED_BYTE, pixels);
+
+        entry.nextUnit += count;
+        budget -= size;
+        if (entry.nextUnit == units) {
+            entry.level++;
+            entry.nextUnit = 0;
+        }
+    }
+
+    if (entry.level == levels.size()) {
+        glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+        glDeleteBuffers(1, &entry.pbo);
+        entry.pbo = 0;
+        entry.data.reset(); // unmaps the cache file
+        entry.done = true;
+    }
+}
@@ -0,0 +1,70 @@
+#ifndef TEXTURESTREAMER_H
+#define TEXTURESTREAMER_H
+
+#include "texturecache.h"
+
+#include <QFuture>
+#include <QOpenGLFunctions_3_3_Core>
+#include <QVector>
+
+// Loads textures through TextureCache on the global thread pool and streams their mip
+// levels into the layers of one GL_TEXTURE_2D_ARRAY through pixel buffer objects, at most
+// budget() bytes per frame. Every layer is resampled to layerSize() squared. Until all
+// layers have arrived, texture() returns a 1x1 grey placeholder array. DXT1 is used when
+// the context supports S3TC and compression() is on.
+class TextureStreamer : protected QOpenGLFunctions_3_3_Core
+{
+public:
+    TextureStreamer();
+
+    // All of these need a current GL 3.3 context
+    void initialize();
+    void cleanup();
+    // Uploads the next slice of pending pixels, call once per frame
+    void update();
+    // Blocks until every texture is decoded and uploaded (benchmark warm-up)
+    void finish();
+
+    // Starts decoding, returns the layer in texture(). The array gets one layer per
+    // load, so all of them have to be started before the first update()
+    int load(const QString &path, bool mirror);
+    GLuint texture() const { return m_array ? m_array : m_placeholder; }
+    bool busy() const;
+
+    void setBudget(qint64 bytesPerFrame) { m_budget = bytesPerFrame; }
+    qint64 budget() const { return m_budget; }
+    // These two affect the loads started afterwards
+    void setCompression(bool enabled) { m_compression = enabled; }
+    bool compression() const { return m_compression; }
+    void setLayerSize(int size) { m_layer_size = size; }
+    int layerSize() const { return m_layer_size; }
+
+private:
+    struct Entry {
+        QString path;
+        QFuture<QSharedPointer<TextureData> > future;
+        QSharedPointer<TextureData> data; // pixels while they are being uploaded
+        GLuint pbo;
+        int level;
+        int nextUnit;    // next row, or row of blocks when compressed
+        bool done;
+    };
+
+    QVector<Entry> m_entries;
+    GLuint m_placeholder;
+    GLuint m_array;      // 0 until every layer is complete
+    GLuint m_staging;    // array being filled
+    QVector<TextureLevel> m_levels; // layout of the staging array, taken from the first texture
+    bool m_staging_compressed;
+    qint64 m_budget;
+    int m_layer_size;
+    bool m_compression;
+    bool m_s3tc;
+    bool m_initialized;
+
+    bool allocate(const TextureData &data);
+    void upload(int layer, qint64 &budget);
+    void publish();
+};
+
+#endif // TEXTURESTREAMER_H
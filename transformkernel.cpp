@@ -0,0 +1,128 @@
+#include "transformkernel.h"
+
+#ifdef LW2_TRANSFORM_SSE
+#include <xmmintrin.h>
+#endif
+
+// Columns of rotate(q) * scale(s), as QMatrix4x4::rotate(QQuaternion) builds them
+static void rotationScale(const QQuaternion &q, const QVector3D &s, float columns[3][3])
+{
+    const float x = q.x(), y = q.y(), z = q.z(), w = q.scalar();
+    const float xx = 2.0f * x * x, yy = 2.0f * y * y, zz = 2.0f * z * z;
+    const float xy = 2.0f * x * y, xz = 2.0f * x * z, yz = 2.0f * y * z;
+    const float wx = 2.0f * w * x, wy = 2.0f * w * y, wz = 2.0f * w * z;
+    columns[0][0] = (1.0f - yy - zz) * s.x();
+    columns[0][1] = (xy + wz) * s.x();
+    columns[0][2] = (xz - wy) * s.x();
+    columns[1][0] = (xy - wz) * s.y();
+    columns[1][1] = (1.0f - xx - zz) * s.y();
+    columns[1][2] = (yz + wx) * s.y();
+    columns[2][0] = (xz + wy) * s.z();
+    columns[2][1] = (yz - wx) * s.z();
+    columns[2][2] = (1.0f - xx - yy) * s.z();
+}
+
+void composeModelMatricesScalar(const QMatrix4x4 &shared, const QVector3D *positions, const QQuaternion *rotations,
+                                const QVector3D *scales, const int *objectSlots, int count, GLfloat *out)
+{
+    float r[3][3];
+    for (int j = 0; j < 3; j++)
+        for (int k = 0; k < 3; k++)
+            r[j][k] = shared(k, j); // column j, row k
+    for (int i = 0; i < count; i++, out += 16) {
+        const int slot = objectSlots[i];
+        float a[3][3];
+        rotationScale(rotations[slot], scales[slot], a);
+        for (int j = 0; j < 3; j++) {
+            for (int c = 0; c < 3; c++)
+                out[4 * j + c] = a[0][c] * r[j][0] + a[1][c] * r[j][1] + a[2][c] * r[j][2];
+            out[4 * j + 3] = 0.0f;
+        }
+        out[12] = positions[slot].x();
+        out[13] = positions[slot].y();
+        out[14] = positions[slot].z();
+        out[15] = 1.0f;
+    }
+}
+
+#ifdef LW2_TRANSFORM_SSE
+// Four objects per iteration in SoA form: quaternion, scale and product entries each hold one
+// object per lane, so the quaternion-to-matrix math and the product with the shared rotation
+// (whose nine entries are splatted once for the whole batch) run four-wide. Each column is
+// transposed back to one object per register on store. A tail of fewer than four objects
+// goes through the scalar version
+static void composeSse(const QMatrix4x4 &shared, const QVector3D *positions, const QQuaternion *rotations,
+                       const QVector3D *scales, const int *objectSlots, int count, GLfloat *out)
+{
+    __m128 r[3][3];
+    for (int j = 0; j < 3; j++)
+        for (int k = 0; k < 3; k++)
+            r[j][k] = _mm_set1_ps(shared(k, j));
+    const __m128 one = _mm_set1_ps(1.0f);
+    const __m128 two = _mm_set1_ps(2.0f);
+    int i = 0;
+    for (; i + 4 <= count; i += 4, out += 64) {
+        const int s0 = objectSlots[i], s1 = objectSlots[i + 1], s2 = objectSlots[i + 2], s3 = objectSlots[i + 3];
+        const QQuaternion &q0 = rotations[s0], &q1 = rotations[s1], &q2 = rotations[s2], &q3 = rotations[s3];
+        const __m128 x = _mm_set_ps(q3.x(), q2.x(), q1.x(), q0.x());
+        const __m128 y = _mm_set_ps(q3.y(), q2.y(), q1.y(), q0.y());
+        const __m128 z = _mm_set_ps(q3.z(), q2.z(), q1.z(), q0.z());
+        const __m128 w = _mm_set_ps(q3.scalar(), q2.scalar(), q1.scalar(), q0.scalar());
+        const __m128 sx = _mm_set_ps(scales[s3].x(), scales[s2].x(), scales[s1].x(), scales[s0].x());
+        const __m128 sy = _mm_set_ps(scales[s3].y(), scales[s2].y(), scales[s1].y(), scales[s0].y());
+        const __m128 sz = _mm_set_ps(scales[s3].z(), scales[s2].z(), scales[s1].z(), scales[s0].z());
+
+        // rotationScale() for four objects at once
+        const __m128 x2 = _mm_mul_ps(two, x), y2 = _mm_mul_ps(two, y), z2 = _mm_mul_ps(two, z);
+        const __m128 xx = _mm_mul_ps(x2, x), yy = _mm_mul_ps(y2, y), zz = _mm_mul_ps(z2, z);
+        const __m128 xy = _mm_mul_ps(x2, y), xz = _mm_mul_ps(x2, z), yz = _mm_mul_ps(y2, z);
+        const __m128 wx = _mm_mul_ps(x2, w), wy = _mm_mul_ps(y2, w), wz = _mm_mul_ps(z2, w);
+        __m128 a[3][3];
+        a[0][0] = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(one, yy), zz), sx);
+        a[0][1] = _mm_mul_ps(_mm_add_ps(xy, wz), sx);
+        a[0][2] = _mm_mul_ps(_mm_sub_ps(xz, wy), sx);
+        a[1][0] = _mm_mul_ps(_mm_sub_ps(xy, wz), sy);
+        a[1][1] = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(one, xx), zz), sy);
+        a[1][2] = _mm_mul_ps(_mm_add_ps(yz, wx), sy);
+        a[2][0] = _mm_mul_ps(_mm_add_ps(xz, wy), sz);
+        a[2][1] = _mm_mul_ps(_mm_sub_ps(yz, wx), sz);
+        a[2][2] = _mm_mul_ps(_mm_sub_ps(_mm_sub_ps(one, xx), yy), sz);
+
+        for (int j = 0; j < 3; j++) {
+            __m128 m[4];
+            for (int c = 0; c < 3; c++)
+                m[c] = _mm_add_ps(_mm_add_ps(_mm_mul_ps(a[0][c], r[j][0]), _mm_mul_ps(a[1][c], r[j][1])),
+                                  _mm_mul_ps(a[2][c], r[j][2]));
+            m[3] = _mm_setzero_ps();
+            _MM_TRANSPOSE4_PS(m[0], m[1], m[2], m[3]);
+            for (int lane = 0; lane < 4; lane++)
+                _mm_storeu_ps(out + 16 * lane + 4 * j, m[lane]);
+        }
+        const int laneSlots[4] = { s0, s1, s2, s3 };
+        for (int lane = 0; lane < 4; lane++) {
+            const QVector3D &position = positions[laneSlots[lane]];
+            _mm_storeu_ps(out + 16 * lane + 12, _mm_set_ps(1.0f, position.z(), position.y(), position.x()));
+        }
+    }
+    composeModelMatricesScalar(shared, positions, rotations, scales, objectSlots + i, count - i, out);
+}
+#endif
+
+void composeModelMatrices(const QMatrix4x4 &shared, const QVector3D *positions, const QQuaternion *rotations,
+                          const QVector3D *scales, const int *objectSlots, int count, GLfloat *out)
+{
+#ifdef LW2_TRANSFORM_SSE
+    composeSse(shared, positions, rotations, scales, objectSlots, count, out);
+#else
+    composeModelMatricesScalar(shared, positions, rotations, scales, objectSlots, count, out);
+#endif
+}
+
+const char *transformKernelName()
+{
+#ifdef LW2_TRANSFORM_SSE
+    return "sse";
+#else
+    return "scalar";
+#endif
+}
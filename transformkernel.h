@@ -0,0 +1,25 @@
+#ifndef TRANSFORMKERNEL_H
+#define TRANSFORMKERNEL_H
+
+#include <QMatrix4x4>
+#include <QQuaternion>
+#include <QVector3D>
+#include <qopengl.h>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define LW2_TRANSFORM_SSE
+#endif
+
+// Model matrices of many objects that all spin by one shared rotation:
+//     model = translate(position) * rotate(rotation) * scale(scale) * shared
+// Only the upper 3x3 of shared is used, so it must be a pure rotation (or scale). Objects are
+// read through slots, matrices are written densely to out, 16 floats each, column-major.
+void composeModelMatrices(const QMatrix4x4 &shared, const QVector3D *positions, const QQuaternion *rotations,
+                          const QVector3D *scales, const int *objectSlots, int count, GLfloat *out);
+// Plain C++ version; composeModelMatrices() falls back to it without SSE
+void composeModelMatricesScalar(const QMatrix4x4 &shared, const QVector3D *positions, const QQuaternion *rotations,
+                                const QVector3D *scales, const int *objectSlots, int count, GLfloat *out);
+// "sse" or "scalar", what composeModelMatrices() runs
+const char *transformKernelName();
+
+#endif // TRANSFORMKERNEL_H
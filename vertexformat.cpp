@@ -0,0 +1,244 @@
+#include "vertexformat.h"
+
+#include <QFloat16>
+#include <cfloat>
+#include <cmath>
+#include <cstring>
+
+static GLsizei positionSize(VertexFormat::PositionType type)
+{
+    // Three halves are padded to keep the next attribute 4-byte aligned
+    return type == VertexFormat::PositionHalf ? 8 : 12;
+}
+
+static GLsizei colorSize(VertexFormat::ColorType type)
+{
+    return type == VertexFormat::ColorPacked ? 4 : 12;
+}
+
+static GLsizei texCoordSize(VertexFormat::TexCoordType type)
+{
+    return type == VertexFormat::TexCoordFloat ? 8 : 4;
+}
+
+static int indexSize(GLenum type)
+{
+    return type == GL_UNSIGNED_BYTE ? 1 : type == GL_UNSIGNED_SHORT ? 2 : 4;
+}
+
+static bool inUnitRange(GLfloat value)
+{
+    return value >= 0.0f && value <= 1.0f;
+}
+
+static void writeHalf(uchar *dst, GLfloat value)
+{
+    qfloat16 half(value);
+    memcpy(dst, &half, sizeof(half));
+}
+
+static void writeUnorm16(uchar *dst, GLfloat value)
+{
+    quint16 unorm = quint16(std::lround(qBound(0.0f, value, 1.0f) * 65535.0f));
+    memcpy(dst, &unorm, sizeof(unorm));
+}
+
+// GL_UNSIGNED_INT_2_10_10_10_REV: red in the low bits, alpha in the top two
+static void writePacked(uchar *dst, const GLfloat *rgb)
+{
+    quint32 packed = 3u << 30;
+    for (int c = 0; c < 3; c++)
+        packed |= quint32(std::lround(qBound(0.0f, rgb[c], 1.0f) * 1023.0f)) << (10 * c);
+    memcpy(dst, &packed, sizeof(packed));
+}
+
+GLsizei VertexFormat::stride() const
+{
+    GLsizei size = positionSize(position) + colorSize(color) + texCoordSize(texCoord) + 1;
+    return (size + 3) & ~3;
+}
+
+QVector<VertexAttribute> VertexFormat::attributes() const
+{
+    const GLuint colorOffset = GLuint(positionSize(position));
+    const GLuint texCoordOffset = colorOffset + GLuint(colorSize(color));
+    const GLuint materialOffset = texCoordOffset + GLuint(texCoordSize(texCoord));
+    QVector<VertexAttribute> attributes;
+    if (position == PositionHalf)
+        attributes.append({ 0, 3, GL_HALF_FLOAT, GL_FALSE, 0 });
+    else
+        attributes.append({ 0, 3, GL_FLOAT, GL_FALSE, 0 });
+    if (color == ColorPacked)
+        attributes.append({ 1, 4, GL_UNSIGNED_INT_2_10_10_10_REV, GL_TRUE, colorOffset });
+    else
+        attributes.append({ 1, 3, GL_FLOAT, GL_FALSE, colorOffset });
+    if (texCoord == TexCoordUnorm16)
+        attributes.append({ 2, 2, GL_UNSIGNED_SHORT, GL_TRUE, texCoordOffset });
+    else if (texCoord == TexCoordHalf)
+        attributes.append({ 2, 2, GL_HALF_FLOAT, GL_FALSE, texCoordOffset });
+    else
+        attributes.append({ 2, 2, GL_FLOAT, GL_FALSE, texCoordOffset });
+    // Not normalized, the shader gets the slot number as a float
+    attributes.append({ 3, 1, GL_UNSIGNED_BYTE, GL_FALSE, materialOffset });
+    return attributes;
+}
+
+QByteArray VertexFormat::pack(const QVector<Vertex> &vertices) const
+{
+    const GLsizei size = stride();
+    const GLsizei colorOffset = positionSize(position);
+    const GLsizei texCoordOffset = colorOffset + colorSize(color);
+    const GLsizei materialOffset = texCoordOffset + texCoordSize(texCoord);
+    QByteArray data(vertices.size() * size, '\0');
+    uchar *dst = reinterpret_cast<uchar *>(data.data());
+    for (const Vertex &vertex : vertices) {
+        if (position == PositionHalf) {
+            for (int c = 0; c < 3; c++)
+                writeHalf(dst + 2 * c, vertex.position[c]);
+        }
+        else {
+            memcpy(dst, vertex.position, sizeof(vertex.position));
+        }
+        if (color == ColorPacked)
+            writePacked(dst + colorOffset, vertex.color);
+        else
+            memcpy(dst + colorOffset, vertex.color, sizeof(vertex.color));
+        for (int c = 0; c < 2; c++) {
+            if (texCoord == TexCoordUnorm16)
+                writeUnorm16(dst + texCoordOffset + 2 * c, vertex.texCoord[c]);
+            else if (texCoord == TexCoordHalf)
+                writeHalf(dst + texCoordOffset + 2 * c, vertex.texCoord[c]);
+        }
+        if (texCoord == TexCoordFloat)
+            memcpy(dst + texCoordOffset, vertex.texCoord, sizeof(vertex.texCoord));
+        dst[materialOffset] = uchar(qBound(0.0f, vertex.material, 255.0f));
+        dst += size;
+    }
+    return data;
+}
+
+VertexFormat VertexFormat::choose(const QVector<Vertex> &vertices)
+{
+    VertexFormat format = { PositionHalf, ColorPacked, TexCoordUnorm16 };
+
+    GLfloat lo[3] = { FLT_MAX, FLT_MAX, FLT_MAX };
+    GLfloat hi[3] = { -FLT_MAX, -FLT_MAX, -FLT_MAX };
+    for (const Vertex &vertex : vertices) {
+        for (int c = 0; c < 3; c++) {
+            lo[c] = qMin(lo[c], vertex.position[c]);
+            hi[c] = qMax(hi[c], vertex.position[c]);
+        }
+    }
+    GLfloat extent = 0.0f;
+    for (int c = 0; c < 3; c++)
+        extent = qMax(extent, hi[c] - lo[c]);
+    // Halves keep 11 significant bits: fine for a mesh around its origin, not for one placed
+    // far away from it. Allow an error of 1/1024 of the mesh size.
+    const GLfloat positionTolerance = extent / 1024.0f;
+    // A texel of a 4096 texture
+    const GLfloat texCoordTolerance = 1.0f / 4096.0f;
+
+    for (const Vertex &vertex : vertices) {
+        for (int c = 0; c < 3; c++) {
+            GLfloat value = vertex.position[c];
+            if (qAbs(value) > 65504.0f || qAbs(float(qfloat16(value)) - value) > positionTolerance)
+                format.position = PositionFloat;
+            if (!inUnitRange(vertex.color[c]))
+                format.color = ColorFloat;
+        }
+        for (int c = 0; c < 2; c++) {
+            GLfloat value = vertex.texCoord[c];
+            if (format.texCoord == TexCoordUnorm16 && !inUnitRange(value))
+                format.texCoord = TexCoordHalf;
+            if (format.texCoord == TexCoordHalf
+                    && (qAbs(value) > 65504.0f || qAbs(float(qfloat16(value)) - value) > texCoordTolerance))
+                format.texCoord = TexCoordFloat;
+        }
+    }
+    return format;
+}
+
+bool VertexFormat::fromLayout(GLsizei stride, const QVector<VertexAttribute> &attributes, VertexFormat &format)
+{
+    for (int position = PositionFloat; position <= PositionHalf; position++) {
+        for (int color = ColorFloat; color <= ColorPacked; color++) {
+            for (int texCoord = TexCoordFloat; texCoord <= TexCoordUnorm16; texCoord++) {
+                const VertexFormat candidate = { PositionType(position), ColorType(color), TexCoordType(texCoord) };
+                if (candidate.stride() != stride)
+                    continue;
+                const QVector<VertexAttribute> expected = candidate.attributes();
+                if (expected.size() != attributes.size())
+                    continue;
+                bool same = true;
+                for (int i = 0; i < expected.size() && same; i++) {
+                    const VertexAttribute &a = expected[i];
+                    const VertexAttribute &b = attributes[i];
+                    same = a.location == b.location && a.components == b.components && a.type == b.type
+                            && a.normalized == b.normalized && a.offset == b.offset;
+                }
+                if (same) {
+                    format = candidate;
+                    return true;
+                }
+            }
+        }
+    }
+    return false;
+}
+
+quint32 VertexFormat::code() const
+{
+    return quint32(position) | quint32(color) << 8 | quint32(texCoord) << 16;
+}
+
+bool VertexFormat::fromCode(quint32 code, VertexFormat &format)
+{
+    const quint32 position = code & 0xff, color = (code >> 8) & 0xff, texCoord = code >> 16;
+    if (position > PositionHalf || color > ColorPacked || texCoord > TexCoordUnorm16)
+        return false;
+    format.position = PositionType(position);
+    format.color = ColorType(color);
+    format.texCoord = TexCoordType(texCoord);
+    return true;
+}
+
+GLenum chooseIndexType(qint64 vertexCount)
+{
+    if (vertexCount <= 256)
+        return GL_UNSIGNED_BYTE;
+    if (vertexCount <= 65536)
+        return GL_UNSIGNED_SHORT;
+    return GL_UNSIGNED_INT;
+}
+
+QByteArray packIndices(const void *indices, GLenum sourceType, GLsizei count, GLenum type)
+{
+    QByteArray data(count * indexSize(type), '\0');
+    const uchar *src = static_cast<const uchar *>(indices);
+    uchar *dst = reinterpret_cast<uchar *>(data.data());
+    for (GLsizei i = 0; i < count; i++) {
+        quint32 index;
+        if (sourceType == GL_UNSIGNED_BYTE) {
+            index = src[i];
+        }
+        else if (sourceType == GL_UNSIGNED_SHORT) {
+            quint16 value;
+            memcpy(&value, src + 2 * i, sizeof(value));
+            index = value;
+        }
+        else {
+            memcpy(&index, src + 4 * i, sizeof(index));
+        }
+        if (type == GL_UNSIGNED_BYTE) {
+            dst[i] = uchar(index);
+        }
+        else if (type == GL_UNSIGNED_SHORT) {
+            quint16 value = quint16(index);
+            memcpy(dst + 2 * i, &value, sizeof(value));
+        }
+        else {
+            memcpy(dst + 4 * i, &index, sizeof(index));
+        }
+    }
+    return data;
+}
@@ -0,0 +1,44 @@
+#ifndef VERTEXFORMAT_H
+#define VERTEXFORMAT_H
+
+#include "meshloader.h"
+
+#include <QByteArray>
+#include <QVector>
+
+// Storage types of the Vertex attributes of one mesh. choose() picks the smallest type each
+// attribute survives without visible loss; the shader sees the same vec3/vec2/float inputs
+// whatever is picked, so meshes of any format draw with the same program.
+struct VertexFormat
+{
+    enum PositionType { PositionFloat, PositionHalf };
+    enum ColorType { ColorFloat, ColorPacked };                         // GL_UNSIGNED_INT_2_10_10_10_REV
+    enum TexCoordType { TexCoordFloat, TexCoordHalf, TexCoordUnorm16 };
+    // The material slot is always one unsigned byte
+
+    PositionType position;
+    ColorType color;
+    TexCoordType texCoord;
+
+    bool operator==(const VertexFormat &other) const
+    {
+        return position == other.position && color == other.color && texCoord == other.texCoord;
+    }
+
+    GLsizei stride() const;
+    QVector<VertexAttribute> attributes() const;
+    QByteArray pack(const QVector<Vertex> &vertices) const;
+
+    static VertexFormat choose(const QVector<Vertex> &vertices);
+    // The format a packed layout was made by, false if stride and attributes match none
+    static bool fromLayout(GLsizei stride, const QVector<VertexAttribute> &attributes, VertexFormat &format);
+    // Stable number for files, fromCode() fails on numbers no format has
+    quint32 code() const;
+    static bool fromCode(quint32 code, VertexFormat &format);
+};
+
+// Smallest index type that can address vertexCount vertices, and the repacked indices
+GLenum chooseIndexType(qint64 vertexCount);
+QByteArray packIndices(const void *indices, GLenum sourceType, GLsizei count, GLenum type);
+
+#endif // VERTEXFORMAT_H
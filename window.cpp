@@ -1,4 +1,5 @@
 #include "glwidget.h"
+#include "renderwindow.h"
 #include "window.h"
 #include <QSlider>
 #include <QVBoxLayout>
@@ -11,19 +12,35 @@
 #include <QOpenGLWidget>
 #include <QMessageBox>
 
-Window::Window(QWidget *parent) : QWidget(parent)
+Window::Window(bool renderThread, QWidget *parent) : QWidget(parent)
 {
-    glWidget = new GLWidget;
+    glWidget = nullptr;
+    renderWindow = nullptr;
+    QWidget *view;
+    QObject *viewObject;
+    if (renderThread) {
+        renderWindow = new RenderWindow;
+        // Keys reach the render window once it has focus; they go the same way as ours
+        renderWindow->installEventFilter(this);
+        view = QWidget::createWindowContainer(renderWindow);
+        view->setMinimumSize(100, 100);
+        viewObject = renderWindow;
+    }
+    else {
+        glWidget = new GLWidget;
+        view = glWidget;
+        viewObject = glWidget;
+    }
     rotationChanger = new QPushButton("Ручное вращение", this);
 
-    connect(rotationChanger, SIGNAL(clicked()), glWidget, SLOT(setRotationType()));
-    connect(rotationChanger, SIGNAL(clicked()), this, SLOT(rotationTextChanger()));
+    connect(rotationChanger, SIGNAL(clicked()), viewObject, SLOT(setRotationType()));
+    connect(viewObject, SIGNAL(rotationTypeChanged()), this, SLOT(rotationTextChanger()));
 
     QVBoxLayout *mainLayout = new QVBoxLayout;
     QHBoxLayout *container = new QHBoxLayout; //Окошко ГЛ, и функционал справа
     QVBoxLayout *additional = new QVBoxLayout; //Пара тестовых кнопок
     additional->setSizeConstraint(QLayout::SetFixedSize);
-    container->addWidget(glWidget);
+    container->addWidget(view);
 
     QWidget *w = new QWidget;
     w->setLayout(container);
@@ -38,7 +55,11 @@ Window::Window(QWidget *parent) : QWidget(parent)
                              "<html><u>WASD</u> - для перемещения камеры в плоскости параллельной объектам.<br>"
                              "<html><u>Mouse scroll</u> - для перемещения камеры от / к пользователю.<br>"
                              "<html><u>ПКМ / ЛКМ</u> - для вращения объектов в ручном режиме.<br>"
-                             "<html><u>Space</u> - для переключения режима вращения.<br><br>"
+                             "<html><u>Space</u> - для переключения режима вращения.<br>"
+                             "<html><u>I</u> - для включения / выключения инстансинга.<br>"
+                             "<html><u>O</u> - для включения / выключения отсечения перекрытых объектов.<br>"
+                             "<html><u>H</u> - для показа статистики производительности.<br>"
+                             "<html><u>C</u> - для начала / остановки записи кадров.<br><br>"
                              "<html><u>Esc</u> - для выхода из программы.");
 }
 
@@ -48,10 +69,60 @@ void Window::keyPressEvent(QKeyEvent *event)
         close();
     if (event->key() == Qt::Key_Space)
         rotationChanger->click();
-    glWidget->keyPressEvent(event);
+    if (renderWindow)
+        renderWindow->keyPressEvent(event);
+    else
+        glWidget->keyPressEvent(event);
+}
+bool Window::eventFilter(QObject *watched, QEvent *event)
+{
+    if (watched == renderWindow && event->type() == QEvent::KeyPress) {
+        keyPressEvent(static_cast<QKeyEvent *>(event));
+        return true;
+    }
+    return QWidget::eventFilter(watched, event);
+}
+void Window::setFrameRateCap(int fps)
+{
+    if (renderWindow)
+        renderWindow->setFrameRateCap(fps);
+    else
+        glWidget->setFrameRateCap(fps);
+}
+bool Window::recordInput(const QString &path)
+{
+    return renderWindow ? renderWindow->startRecording(path) : glWidget->startRecording(path);
+}
+bool Window::replayInput(const QString &path)
+{
+    return renderWindow ? renderWindow->startReplay(path) : glWidget->startReplay(path);
+}
+void Window::setCapture(const QString &directory, FrameCapture::Format format, bool start)
+{
+    if (renderWindow) {
+        renderWindow->setCaptureTarget(directory, format);
+        renderWindow->setCapturing(start);
+        return;
+    }
+    glWidget->setCaptureTarget(directory, format);
+    if (start)
+        glWidget->setCapturing(true);
+}
+// spec is "kind=path", kind is one of Renderer::meshName()
+bool Window::loadMesh(const QString &spec)
+{
+    Renderer::MeshKind kind;
+    int separator = spec.indexOf('=');
+    if (separator < 0 || !Renderer::meshKindFromName(spec.left(separator), kind))
+        return false;
+    if (renderWindow)
+        renderWindow->loadMesh(kind, spec.mid(separator + 1));
+    else
+        glWidget->loadMesh(kind, spec.mid(separator + 1));
+    return true;
 }
 void Window::rotationTextChanger() {
-    if (glWidget->autoRotate) {
+    if (renderWindow ? renderWindow->autoRotate() : glWidget->autoRotate()) {
         rotationChanger->setText("Ручное вращение");
     }
     else {
@@ -3,26 +3,38 @@
 
 #include <QWidget>
 
+#include "framecapture.h"
+
 QT_BEGIN_NAMESPACE
 class QSlider;
 class QPushButton;
 QT_END_NAMESPACE
 class GLWidget;
+class RenderWindow;
 
 class Window : public QWidget
 {
     Q_OBJECT
 
 public:
-    Window(QWidget *parent = nullptr);
+    // renderThread - draw frames on a RenderThread instead of in GLWidget on the GUI thread
+    Window(bool renderThread = false, QWidget *parent = nullptr);
+    void setFrameRateCap(int fps);
+    bool loadMesh(const QString &spec);
+    bool recordInput(const QString &path);
+    bool replayInput(const QString &path);
+    void setCapture(const QString &directory, FrameCapture::Format format, bool start);
 protected:
     void keyPressEvent(QKeyEvent *event) override;
+    bool eventFilter(QObject *watched, QEvent *event) override;
 
 private slots:
     void rotationTextChanger();
 
 private:
+    // Exactly one of the two views is created
     GLWidget *glWidget;
+    RenderWindow *renderWindow;
     QPushButton *rotationChanger;
 };
 